@@ -0,0 +1,78 @@
+#include "../cobs.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace trctl
+{
+
+struct bench_result
+{
+        double encode_gbs;
+        double decode_gbs;
+};
+
+double gbs( std::size_t bytes, std::chrono::steady_clock::duration d )
+{
+        return (double) bytes / std::chrono::duration< double >( d ).count() / 1e9;
+}
+
+bench_result run( std::vector< uint8_t > const& payload, std::size_t iters )
+{
+        std::vector< uint8_t > enc( payload.size() + payload.size() / 254 + 3 );
+        std::vector< uint8_t > dec( payload.size() + 1 );
+        std::size_t            enc_n = 0;
+
+        auto t0 = std::chrono::steady_clock::now();
+        for ( std::size_t i = 0; i < iters; ++i ) {
+                auto [succ, used] = encode_cobs( payload, enc );
+                if ( !succ )
+                        std::abort();
+                enc_n = used.size();
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        for ( std::size_t i = 0; i < iters; ++i ) {
+                auto [succ, used] = decode_cobs( std::span{ enc }.subspan( 0, enc_n ), dec );
+                if ( !succ || used.size() != payload.size() )
+                        std::abort();
+        }
+        auto t2 = std::chrono::steady_clock::now();
+
+        return {
+            .encode_gbs = gbs( payload.size() * iters, t1 - t0 ),
+            .decode_gbs = gbs( payload.size() * iters, t2 - t1 ),
+        };
+}
+
+}  // namespace trctl
+
+int main()
+{
+        using namespace trctl;
+
+        static constexpr std::size_t size  = 16 * 1024 * 1024;
+        static constexpr std::size_t iters = 64;
+
+        std::mt19937           gen( 42 );
+        std::vector< uint8_t > rnd( size ), zeros( size, 0 ), nz( size );
+        for ( std::size_t i = 0; i < size; ++i ) {
+                rnd[i] = gen();
+                nz[i]  = 1 + gen() % 255;
+        }
+
+        std::printf(
+            "cobs kernel: %s, payload %zu MB x %zu\n", cobs_kernel_name(), size >> 20, iters );
+        for ( auto [name, data] : { std::pair{ "random", &rnd },
+                                    std::pair{ "all-zero", &zeros },
+                                    std::pair{ "zero-free", &nz } } ) {
+                auto r = run( *data, iters );
+                std::printf(
+                    "%-10s encode: %6.2f GB/s  decode: %6.2f GB/s\n",
+                    name,
+                    r.encode_gbs,
+                    r.decode_gbs );
+        }
+        return 0;
+}
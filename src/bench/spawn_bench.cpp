@@ -0,0 +1,138 @@
+#include "../unit/process.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+namespace trctl
+{
+
+enum class spawn_mode
+{
+        shell,
+        direct,
+        warm
+};
+
+struct spawn_result
+{
+        double ms     = 0;
+        bool   failed = false;
+        bool   done   = false;
+};
+
+inline double ms_since( std::chrono::steady_clock::time_point t )
+{
+        return std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - t )
+            .count();
+}
+
+task< void > run_spawns(
+    task_ctx&     tctx,
+    proc_ctx&     pctx,
+    spawn_mode    mode,
+    char const*   cwd,
+    uint32_t      first_id,
+    uint32_t      n,
+    spawn_result& res )
+{
+        auto t0 = std::chrono::steady_clock::now();
+        for ( uint32_t id = first_id; id < first_id + n; ++id ) {
+                // same spec as the unit builds for a task running `true`
+                task_spec spec;
+                spec.cwd  = cwd;
+                spec.warm = mode == spawn_mode::warm;
+                if ( mode == spawn_mode::shell ) {
+                        spec.binary = "/bin/bash";
+                        spec.args   = { "--login", "-c", "exec \"$@\"", "--" };
+                } else if ( mode == spawn_mode::direct ) {
+                        spec.binary = "true";
+                }
+                spec.args.emplace_back( "true" );
+                if ( co_await (
+                         task_start( tctx, pctx, id, std::move( spec ) ) | ecor::sink_err ) ) {
+                        res.failed = true;
+                        break;
+                }
+                // a login shell may print something before `true` exits
+                for ( bool exited = false; !exited; ) {
+                        auto r = co_await (
+                            task_progress( tctx, pctx, id ) | ecor::err_to_val | ecor::as_variant );
+                        auto* rep = std::get_if< progress_report >( &r );
+                        if ( !rep ) {
+                                res.failed = true;
+                                break;
+                        }
+                        exited = std::ranges::any_of( rep->events, proc_stream::is_exit );
+                }
+                co_await ( task_cancel( tctx, pctx, id ) | ecor::sink_err );
+                if ( res.failed )
+                        break;
+        }
+        res.ms   = ms_since( t0 );
+        res.done = true;
+}
+
+task< void > stop( proc_ctx& pctx, bool& done )
+{
+        co_await pctx.shutdown();
+        done = true;
+}
+
+}  // namespace trctl
+
+/// Measures how long sequential tasks running `true` take from start to reported exit, spawned
+/// through a login shell, exec'd directly and run in a warm shell. The number of tasks per mode
+/// can be passed as argument, defaults to 1000.
+int main( int argc, char** argv )
+{
+        using namespace trctl;
+
+        spdlog::set_level( spdlog::level::warn );
+
+        uint32_t n = argc > 1 ? std::strtoul( argv[1], nullptr, 10 ) : 1000;
+
+        uv_loop_t*            loop    = uv_default_loop();
+        std::filesystem::path workdir = std::filesystem::temp_directory_path() / "trctl_spawn";
+        std::filesystem::create_directories( workdir );
+
+        static uint8_t tctx_buffer[1024 * 64];
+        task_core      core{ loop };
+        task_ctx       tctx{ loop, core, tctx_buffer };
+
+        auto pctx = std::make_unique< proc_ctx >( loop, core );
+        auto cwd  = workdir.string();
+
+        uint32_t first_id = 1;
+        for ( auto [mode, name] : { std::pair{ spawn_mode::shell, "shell" },
+                                    std::pair{ spawn_mode::direct, "direct" },
+                                    std::pair{ spawn_mode::warm, "warm" } } ) {
+                spawn_result res;
+
+                auto op = run_spawns( tctx, *pctx, mode, cwd.c_str(), first_id, n, res )
+                              .connect( ecor::_dummy_receiver{} );
+                op.start();
+                while ( !res.done )
+                        uv_run( loop, UV_RUN_ONCE );
+                first_id += n;
+                if ( res.failed ) {
+                        std::fprintf( stderr, "%s tasks failed\n", name );
+                        return 1;
+                }
+                std::printf(
+                    "%-6s  %u tasks: %9.1f ms  %7.3f ms per task\n",
+                    name,
+                    n,
+                    res.ms,
+                    res.ms / n );
+        }
+
+        bool stopped = false;
+        auto op      = stop( *pctx, stopped ).connect( ecor::_dummy_receiver{} );
+        op.start();
+        while ( !stopped )
+                uv_run( loop, UV_RUN_ONCE );
+        std::filesystem::remove_all( workdir );
+        return 0;
+}
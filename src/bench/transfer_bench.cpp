@@ -0,0 +1,133 @@
+#include "../unit/fs_transfer.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <vector>
+
+namespace trctl
+{
+
+struct transfer_result
+{
+        double write_ms = 0;
+        double end_ms   = 0;
+        error  e        = error::none;
+        bool   done     = false;
+};
+
+inline double ms_since( std::chrono::steady_clock::time_point t )
+{
+        return std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - t )
+            .count();
+}
+
+task< void > run_transfer(
+    task_ctx&                   tctx,
+    file_transfer_ctx&          fctx,
+    zll::ll_list< folder_dep >& deps,
+    std::string const&          path,
+    uint64_t                    size,
+    transfer_result&            res )
+{
+        // largest chunk the unit accepts, sent one at a time with a window of 1, so each starts at
+        // the acknowledged offset and ends within the window claim() grants
+        static constexpr std::size_t chunk_size = max_transfer_chunk;
+
+        std::vector< uint8_t > chunk( chunk_size );
+        for ( std::size_t i = 0; i < chunk.size(); ++i )
+                chunk[i] = (uint8_t) ( i * 31 + 7 );
+
+        // includes the preallocation done by start_transfer
+        auto t0 = std::chrono::steady_clock::now();
+        if ( co_await ( start_transfer( tctx, fctx, 1, path, size, 1, deps ) | ecor::sink_err ) ) {
+                res.e    = error::input_error;
+                res.done = true;
+                co_return;
+        }
+
+        fnv1a hasher;
+        for ( uint64_t offset = 0; offset < size; offset += chunk_size ) {
+                auto d = std::span< uint8_t const >{ chunk }.subspan(
+                    0, std::min< uint64_t >( chunk_size, size - offset ) );
+                hasher( d );
+                if ( co_await ( transfer_data( tctx, fctx, 1, offset, d ) | ecor::sink_err ) ) {
+                        res.e    = error::input_error;
+                        res.done = true;
+                        co_return;
+                }
+        }
+        res.write_ms = ms_since( t0 );
+
+        auto t1    = std::chrono::steady_clock::now();
+        res.e      = co_await end_transfer( tctx, fctx, 1, hasher.hash );
+        res.end_ms = ms_since( t1 );
+        res.done   = true;
+}
+
+}  // namespace trctl
+
+/// Measures how long writing all data of a file and end_transfer() take, with and without
+/// preallocation of the file at start. Sizes in MB can be passed as arguments, defaults to 1, 100
+/// and 1024.
+int main( int argc, char** argv )
+{
+        using namespace trctl;
+
+        spdlog::set_level( spdlog::level::warn );
+
+        std::vector< uint64_t > sizes_mb;
+        for ( int i = 1; i < argc; ++i )
+                sizes_mb.push_back( std::strtoull( argv[i], nullptr, 10 ) );
+        if ( sizes_mb.empty() )
+                sizes_mb = { 1, 100, 1024 };
+
+        uv_loop_t*            loop    = uv_default_loop();
+        std::filesystem::path workdir = std::filesystem::temp_directory_path() / "trctl_bench";
+        std::filesystem::create_directories( workdir );
+
+        static uint8_t             tctx_buffer[1024 * 64];
+        task_core                  core{ loop };
+        task_ctx                   tctx{ loop, core, tctx_buffer };
+        zll::ll_list< folder_dep > deps;
+
+        auto fctx = std::make_unique< file_transfer_ctx >( loop, core, workdir );
+
+        for ( uint64_t mb : sizes_mb ) {
+                double write_ms[2] = {};
+                for ( bool prealloc : { false, true } ) {
+                        auto            path = ( workdir / "bench.bin" ).string();
+                        transfer_result res;
+
+                        fctx->preallocate = prealloc;
+                        auto op = run_transfer( tctx, *fctx, deps, path, mb * 1024 * 1024, res )
+                                      .connect( ecor::_dummy_receiver{} );
+                        op.start();
+                        while ( !res.done )
+                                uv_run( loop, UV_RUN_ONCE );
+                        if ( res.e != error::none ) {
+                                std::fprintf(
+                                    stderr, "transfer of %lu MB failed\n", (unsigned long) mb );
+                                return 1;
+                        }
+                        std::printf(
+                            "%6lu MB  prealloc: %-3s  write: %9.1f ms  end: %8.3f ms\n",
+                            (unsigned long) mb,
+                            prealloc ? "on" : "off",
+                            res.write_ms,
+                            res.end_ms );
+                        write_ms[prealloc] = res.write_ms;
+                        std::filesystem::remove( path );
+                }
+                std::printf(
+                    "%6lu MB  saved by preallocation: %9.1f ms\n",
+                    (unsigned long) mb,
+                    write_ms[0] - write_ms[1] );
+        }
+        // let the transfer slots be destroyed
+        for ( std::size_t i = 0; i < 16; ++i )
+                uv_run( loop, UV_RUN_NOWAIT );
+        std::filesystem::remove_all( workdir );
+        return 0;
+}
@@ -10,26 +10,24 @@ namespace
                 std::abort();
         }
 
-        void client_read( uv_stream_t* cl, ssize_t nread, uv_buf_t const* buf )
+        void client_read( uv_stream_t* cl, ssize_t nread, uv_buf_t const* )
         {
                 auto& c = *(client*) ( cl->data );
                 if ( nread > 0 )
-                        c.recv._handle_rx( { (uint8_t*) buf->base, (std::size_t) nread } );
+                        c.recv._commit_rx( (std::size_t) nread );
                 if ( nread < 0 ) {
                         if ( nread != UV_EOF )
                                 spdlog::error( "Read error {}", uv_err_name( nread ) );
                         uv_close( (uv_handle_t*) cl, client_close );
                 }
-
-                free( buf->base );
         }
 
-        void client_alloc( uv_handle_t*, size_t suggested_size, uv_buf_t* buf )
+        void client_alloc( uv_handle_t* handle, size_t, uv_buf_t* buf )
         {
-                // auto& c = *(client*) ( handle->data );
-                // XXX: should use memory pool from client instead
-                buf->base = (char*) malloc( suggested_size );
-                buf->len  = suggested_size;
+                auto& c   = *(client*) ( handle->data );
+                auto  w   = c.recv.rx_window();
+                buf->base = (char*) w.data();
+                buf->len  = w.size();
         }
 
         void client_on_connect( uv_connect_t* req, int status )
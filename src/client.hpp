@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ecor/ecor.hpp"
+#include "npb.hpp"
 #include "util.hpp"
 
 #include <span>
@@ -12,15 +13,25 @@ namespace trctl
 
 struct client
 {
+        /// Incoming message and means to reply to it. `data` points directly into the receive
+        /// buffer of the client and is valid only until the receiver returns, it has to be
+        /// decoded before the first suspension.
         struct promise
         {
-                client&                 c;
-                circular_buffer_memory& mem;
-                uspan< uint8_t >        data;
+                client&                    c;
+                circular_buffer_memory&    mem;
+                std::span< uint8_t const > data;
 
+                /// Sends the reply, callers should wait for `c.gate` first
                 send_status fullfill( std::span< uint8_t const > data )
                 {
-                        return cobs_send( mem, &c.tcp, data );
+                        return c.tx.send( data );
+                }
+
+                /// Sends `msg` encoded straight into the reply frame
+                send_status fullfill( pb_msgdesc_t const* fields, void const* msg )
+                {
+                        return npb_send( c.tx, fields, msg );
                 }
         };
 
@@ -37,18 +48,11 @@ struct client
 
                 void set_value( cobs_receiver::reply r )
                 {
-                        auto data = _client.mem.make_span< uint8_t >( r.data.size() );
-                        if ( !data.data() ) {
-                                R::set_error( cobs_receiver::err{} );
-                                return;
-                        }
-
-                        std::copy_n( r.data.data(), r.data.size(), data.data() );
                         R::set_value(
                             promise{
                                 .c    = _client,
                                 .mem  = _client.mem,
-                                .data = std::move( data ),
+                                .data = r.data,
                             } );
                 }
         };
@@ -93,12 +97,15 @@ struct client
         }
         uv_tcp_t     tcp;
         uv_connect_t connect;
+        write_gate   gate{ (uv_stream_t*) &tcp };
 
-        uint8_t       rx_buffer[1024 * 8];
+        // holds a whole frame, the largest are file transfer chunks
+        uint8_t       rx_buffer[1024 * 64];
         cobs_receiver recv{ rx_buffer };
 
         uint8_t                buffer[1024 * 1024];
         circular_buffer_memory mem{ std::span{ buffer } };
+        frame_sender           tx{ (uv_stream_t*) &tcp, mem, gate };
 };
 
 int client_init( client& c, uv_loop_t* loop, std::string_view addr, int port );
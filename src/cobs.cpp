@@ -0,0 +1,93 @@
+#include "cobs.hpp"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define TRCTL_COBS_X86
+#endif
+
+namespace trctl
+{
+namespace
+{
+
+        std::size_t find_zero_scalar( uint8_t const* p, std::size_t n )
+        {
+                auto* z = (uint8_t const*) std::memchr( p, 0x00, n );
+                return z ? z - p : n;
+        }
+
+#ifdef TRCTL_COBS_X86
+
+        __attribute__( ( target( "sse2" ) ) ) std::size_t
+        find_zero_sse2( uint8_t const* p, std::size_t n )
+        {
+                __m128i const zero = _mm_setzero_si128();
+                std::size_t   i    = 0;
+                for ( ; i + 16 <= n; i += 16 ) {
+                        __m128i const v = _mm_loadu_si128( (__m128i const*) ( p + i ) );
+                        int const     m = _mm_movemask_epi8( _mm_cmpeq_epi8( v, zero ) );
+                        if ( m )
+                                return i + __builtin_ctz( m );
+                }
+                for ( ; i < n; ++i )
+                        if ( p[i] == 0 )
+                                return i;
+                return n;
+        }
+
+        __attribute__( ( target( "avx2" ) ) ) std::size_t
+        find_zero_avx2( uint8_t const* p, std::size_t n )
+        {
+                __m256i const zero = _mm256_setzero_si256();
+                std::size_t   i    = 0;
+                for ( ; i + 32 <= n; i += 32 ) {
+                        __m256i const  v = _mm256_loadu_si256( (__m256i const*) ( p + i ) );
+                        unsigned const m =
+                            (unsigned) _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, zero ) );
+                        if ( m )
+                                return i + __builtin_ctz( m );
+                }
+                return i + find_zero_sse2( p + i, n - i );
+        }
+
+#endif
+
+        struct kernel
+        {
+                std::size_t ( *find_zero )( uint8_t const*, std::size_t );
+                char const* name;
+        };
+
+        kernel select_kernel()
+        {
+#ifdef TRCTL_COBS_X86
+                __builtin_cpu_init();
+                if ( __builtin_cpu_supports( "avx2" ) )
+                        return { find_zero_avx2, "avx2" };
+                if ( __builtin_cpu_supports( "sse2" ) )
+                        return { find_zero_sse2, "sse2" };
+#endif
+                return { find_zero_scalar, "scalar" };
+        }
+
+        kernel const& get_kernel()
+        {
+                static kernel const k = select_kernel();
+                return k;
+        }
+
+}  // namespace
+
+std::size_t cobs_find_zero( uint8_t const* p, std::size_t n )
+{
+        if ( n == 0 )
+                return 0;
+        return get_kernel().find_zero( p, n );
+}
+
+char const* cobs_kernel_name()
+{
+        return get_kernel().name;
+}
+
+}  // namespace trctl
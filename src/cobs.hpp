@@ -1,6 +1,9 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <optional>
 #include <span>
 #include <tuple>
@@ -8,6 +11,12 @@
 namespace trctl
 {
 
+/// Returns index of the first zero byte in the `n` bytes at `p`, or `n` if there is none. Uses
+/// SSE2/AVX2 kernel when supported by the CPU, selected at runtime.
+std::size_t cobs_find_zero( uint8_t const* p, std::size_t n );
+
+/// Name of the kernel selected for cobs_find_zero().
+char const* cobs_kernel_name();
 
 class cobs_encoder
 {
@@ -42,6 +51,36 @@ public:
                 return p != target.data() + target.size();
         }
 
+        /// Same as inserting `data` byte by byte, runs of non-zero bytes are copied at once
+        bool insert( std::span< uint8_t const > data )
+        {
+                uint8_t* const e = target.data() + target.size();
+                while ( !data.empty() ) {
+                        std::size_t const r = cobs_find_zero(
+                            data.data(), std::min< std::size_t >( data.size(), 255 - count ) );
+                        if ( (std::size_t) ( e - p ) <= r )
+                                return false;
+                        std::memcpy( p, data.data(), r );
+                        p += r;
+                        count = uint8_t( count + r );
+                        data  = data.subspan( r );
+                        if ( count == 255 ) {
+                                *last_p = uint8_t{ 255 };
+                                count   = 1;
+                                last_p  = p++;
+                        } else if ( !data.empty() ) {
+                                // the run ended with a zero byte
+                                *last_p = count;
+                                count   = 1;
+                                last_p  = p++;
+                                data    = data.subspan( 1 );
+                        }
+                        if ( p == e )
+                                return false;
+                }
+                return true;
+        }
+
         std::span< uint8_t > commit() &&
         {
                 *last_p = uint8_t{ count };
@@ -58,14 +97,39 @@ private:
 /// Encodes data from source range into target buffer with Consistent Overhead Byte Stuffing (COBS)
 /// encoding, returns bool indicating whenever conversion succeeded and subview used for conversion
 /// from target buffer. Note that this does not store 0 at the end.
+///
+/// Works on whole blocks of up to 254 bytes, output is identical to the one of cobs_encoder.
 inline std::tuple< bool, std::span< uint8_t > >
 encode_cobs( std::span< uint8_t const > source, std::span< uint8_t > target )
 {
-        cobs_encoder e( target );
-        for ( uint8_t b : source )
-                if ( !e.insert( b ) )
+        uint8_t const* s    = source.data();
+        std::size_t    left = source.size();
+        uint8_t*       out  = target.data();
+        uint8_t* const e    = target.data() + target.size();
+        // cobs_encoder requires one spare byte past the output for non-empty input
+        std::size_t const spare = source.empty() ? 0 : 1;
+
+        for ( ;; ) {
+                // runs of zeros are common in protobuf payloads, skip the kernel call for them
+                std::size_t const r = left != 0 && *s == 0 ?
+                                          0 :
+                                          cobs_find_zero( s, std::min< std::size_t >( left, 254 ) );
+                if ( (std::size_t) ( e - out ) < r + 1 + spare )
                         return { false, {} };
-        return { true, std::move( e ).commit() };
+                *out = static_cast< uint8_t >( r + 1 );
+                std::copy_n( s, r, out + 1 );
+                out += r + 1;
+                if ( r == 254 ) {
+                        s += r;
+                        left -= r;
+                } else if ( r == left ) {
+                        break;
+                } else {
+                        s += r + 1;
+                        left -= r + 1;
+                }
+        }
+        return { true, { target.data(), out } };
 }
 
 struct cobs_decoder
@@ -118,26 +182,36 @@ struct cobs_decoder
 /// Decodes data from source range into target buffer with Consistent Overhead Byte Stuffing (COBS)
 /// encoding, returns bool indicating whenever conversion succeeded and subview used for conversion
 /// from target buffer. Note that this does not expect 0 at the end.
+///
+/// Copies whole blocks at once, source and target may start at the same address for in-place
+/// decoding.
 inline std::tuple< bool, std::span< uint8_t > >
 decode_cobs( std::span< uint8_t const > source, std::span< uint8_t > target )
 {
-
-        uint8_t*     target_current = target.data();
-        cobs_decoder dec( source.front() );
-
-        for ( std::size_t i = 1; i < source.size(); ++i ) {
-                auto&                    b   = source[i];
-                std::optional< uint8_t > val = dec.iter( b );
-
-                if ( !val.has_value() )
-                        continue;
-                *target_current = *val;
-                target_current += 1;
-
-                if ( target_current == target.data() + target.size() )
+        uint8_t const*       s   = source.data();
+        uint8_t const* const se  = source.data() + source.size();
+        uint8_t*             out = target.data();
+        uint8_t* const       e   = target.data() + target.size();
+
+        while ( s != se ) {
+                uint8_t const code = *s++;
+                if ( code == 0 )
                         return { false, target };
+                std::size_t const n = std::min< std::size_t >( code - 1, se - s );
+                if ( n != 0 && (std::size_t) ( e - out ) <= n )
+                        return { false, target };
+                if ( n != 0 ) {
+                        std::memmove( out, s, n );
+                        out += n;
+                        s += n;
+                }
+                if ( code != 255 && s != se ) {
+                        if ( e - out <= 1 )
+                                return { false, target };
+                        *out++ = 0;
+                }
         }
-        return { true, { target.data(), target_current } };
+        return { true, { target.data(), out } };
 }
 
 
@@ -4,8 +4,11 @@
 #include "task.hpp"
 #include "util.hpp"
 
+#include <cerrno>
 #include <ecor/ecor.hpp>
+#include <fcntl.h>
 #include <spdlog/spdlog.h>
+#include <unistd.h>
 #include <uv.h>
 
 namespace trctl
@@ -175,6 +178,75 @@ struct _fs_write
 };
 using fs_write = _sender< _fs_write >;
 
+/// Reserves `size` bytes for the file, blocking. Falls back to extending the file with ftruncate
+/// on filesystems without fallocate. Returns 0 or a libuv error code.
+inline int fs_allocate_blocking( uv_file fh, uint64_t size )
+{
+#ifdef __linux__
+        if ( ::fallocate( fh, 0, 0, (off_t) size ) == 0 )
+                return 0;
+        if ( errno != EOPNOTSUPP && errno != ENOSYS )
+                return uv_translate_sys_error( errno );
+#endif
+        if ( ::ftruncate( fh, (off_t) size ) == 0 )
+                return 0;
+        return uv_translate_sys_error( errno );
+}
+
+struct _fs_allocate
+{
+        using value_sig = ecor::set_value_t();
+
+        uv_loop_t* loop;
+        uv_file    fh;
+        uint64_t   size;
+        uv_work_t  work;
+        int        result = 0;
+
+        template < typename OP >
+        void start( OP& op )
+        {
+                work.data = &op;
+                int r     = uv_queue_work(
+                    loop,
+                    &work,
+                    +[]( uv_work_t* w ) -> void {
+                            auto& ctx  = ( (OP*) w->data )->ctx;
+                            ctx.result = fs_allocate_blocking( ctx.fh, ctx.size );
+                    },
+                    +[]( uv_work_t* w, int status ) -> void {
+                            auto& op = *( (OP*) w->data );
+                            if ( status < 0 )
+                                    op.ctx.result = status;
+                            if ( op.ctx.result == UV_ENOSPC ) {
+                                    spdlog::error(
+                                        "Not enough space to allocate {} bytes (fh={})",
+                                        op.ctx.size,
+                                        op.ctx.fh );
+                                    op.recv.set_error( error::no_space );
+                                    return;
+                            }
+                            if ( op.ctx.result < 0 ) {
+                                    spdlog::error(
+                                        "Failed to allocate {} bytes (fh={}): {}",
+                                        op.ctx.size,
+                                        op.ctx.fh,
+                                        uv_strerror( op.ctx.result ) );
+                                    op.recv.set_error( error::libuv_error );
+                                    return;
+                            }
+                            spdlog::info( "Allocated {} bytes (fh={})", op.ctx.size, op.ctx.fh );
+                            op.recv.set_value();
+                    } );
+                if ( r < 0 ) {
+                        spdlog::error( "Failed to queue allocation: {}", uv_strerror( r ) );
+                        op.recv.set_error( error::libuv_error );
+                }
+        }
+};
+
+using fs_allocate = _sender< _fs_allocate >;
+
 struct _fs_read
 {
         using value_sig = ecor::set_value_t( std::span< uint8_t > );
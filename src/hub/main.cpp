@@ -1,6 +1,8 @@
 #include "../server.hpp"
 #include "../task.hpp"
 #include "iface.hpp"
+#include "transact.hpp"
+#include "upload.hpp"
 
 #include <CLI/CLI.hpp>
 
@@ -13,46 +15,6 @@ struct unit_repr
 };
 
 
-ecor::task< unit_to_hub > transact( task_ctx& ctx, server_client& c, hub_to_unit data )
-{
-        static constexpr std::size_t mem_size = 1024 * 8;
-        uint8_t                      buffer[mem_size];
-        circular_buffer_memory       mem{ std::span{ buffer } };
-
-        std::size_t     n = 128;
-        uint8_t*        p = (uint8_t*) mem.allocate( n, 1 );
-        npb_ostream_ctx octx{ .buff = std::span{ p, n } };
-        pb_ostream_t    stream = npb_ostream_from( octx );
-        if ( !pb_encode( &stream, hub_to_unit_fields, &data ) ) {
-                spdlog::error( "Encoding error: {}", PB_GET_ERROR( &stream ) );
-                // XXX: signal error
-                co_return {};
-        }
-
-        auto res = co_await (
-            c.transact( { p, stream.bytes_written } ) | ecor::err_to_val | ecor::as_variant );
-        if ( std::get_if< cobs_receiver::err >( &res ) ) {
-                spdlog::error( "Transaction error" );
-                // XXX: signal error
-                co_return {};
-        }
-        auto&           repl = *std::get_if< cobs_receiver::reply >( &res );
-        npb_istream_ctx ictx{ .buff = repl.data, .mem = mem };
-        pb_istream_t    istream = npb_istream_from( ictx );
-        unit_to_hub     msg;
-        if ( !pb_decode( &istream, unit_to_hub_fields, &msg ) ) {
-                spdlog::error( "Decoding error: {}", PB_GET_ERROR( &istream ) );
-                // XXX: signal error
-                co_return {};
-        }
-        if ( !msg.has_ts ) {
-                spdlog::error( "No timestamp in response" );
-                // XXX: signal error
-                co_return {};
-        }
-        co_return msg;
-}
-
 ecor::task< init_msg > transact_init( task_ctx& ctx, server_client& c )
 {
         hub_to_unit msg = hub_to_unit_init_default;
@@ -63,10 +25,11 @@ ecor::task< init_msg > transact_init( task_ctx& ctx, server_client& c )
                 // XXX: signal error
                 co_return {};
         }
+        if ( resp.sub.init.mac_addr )
+                c.server.bind_mac( c, resp.sub.init.mac_addr );
         co_return resp.sub.init;
 }
 
-
 ecor::task< unit_repr > unit_handle_init( task_ctx& ctx, server_client& c )
 {
 
@@ -78,13 +41,26 @@ ecor::task< unit_repr > unit_handle_init( task_ctx& ctx, server_client& c )
 int main( int argc, char** argv )
 {
         uv_disable_stdio_inheritance();
-        int      port;
-        CLI::App app{ "trctl" };
+        int         port;
+        std::size_t threads;
+        CLI::App    app{ "trctl" };
 
         app.add_option( "-p,--port", port, "Port to listen on" )->default_val( "7000" );
+        app.add_option( "-t,--threads", threads, "Event loops serving units, each in own thread" )
+            ->default_val( "1" );
 
         CLI11_PARSE( app, argc, argv );
 
+        if ( threads > 1 ) {
+                trctl::server_shards shards;
+                if ( int e = trctl::server_init( shards, port, threads ); e ) {
+                        std::cerr << "Server init failed: " << uv_strerror( e ) << std::endl;
+                        return 1;
+                }
+                shards.join();
+                return 0;
+        }
+
         uv_loop_t* loop = uv_default_loop();
 
         trctl::server server;
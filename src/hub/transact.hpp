@@ -0,0 +1,121 @@
+#pragma once
+
+#include "../server.hpp"
+#include "../task.hpp"
+#include "iface.hpp"
+
+#include <algorithm>
+#include <span>
+
+namespace trctl
+{
+
+/// Sends `data` with a fresh req_id and decodes the reply, which stays empty if the transaction
+/// failed.
+inline ecor::task< unit_to_hub > transact( task_ctx& ctx, server_client& c, hub_to_unit data )
+{
+        static constexpr std::size_t mem_size = 1024 * 8;
+        uint8_t                      buffer[mem_size];
+        circular_buffer_memory       mem{ std::span{ buffer } };
+
+        data.req_id = c.next_req_id();
+
+        auto res = co_await (
+            c.transact( data.req_id, hub_to_unit_fields, &data ) | ecor::err_to_val |
+            ecor::as_variant );
+        if ( std::get_if< cobs_receiver::err >( &res ) ) {
+                spdlog::error( "Transaction error" );
+                // XXX: signal error
+                co_return {};
+        }
+        auto&           repl = *std::get_if< cobs_receiver::reply >( &res );
+        npb_istream_ctx ictx{ .buff = repl.data, .mem = mem };
+        pb_istream_t    istream = npb_istream_from( ictx );
+        unit_to_hub     msg;
+        if ( !pb_decode( &istream, unit_to_hub_fields, &msg ) ) {
+                spdlog::error( "Decoding error: {}", PB_GET_ERROR( &istream ) );
+                // XXX: signal error
+                co_return {};
+        }
+        if ( !msg.has_ts ) {
+                spdlog::error( "No timestamp in response" );
+                // XXX: signal error
+                co_return {};
+        }
+        co_return msg;
+}
+
+/// Sends all `reqs` in one frame and decodes the replies into `resps`, in the same order. Data of
+/// the replies is allocated from `mem`. Returns false if the unit did not answer every request.
+inline ecor::task< bool > transact_batch(
+    task_ctx&                      ctx,
+    server_client&                 c,
+    circular_buffer_memory&        mem,
+    std::span< hub_to_unit const > reqs,
+    std::span< unit_to_hub >       resps )
+{
+        if ( resps.size() < reqs.size() )
+                co_return false;
+
+        auto* entries = (npb_data_list*) mem.allocate(
+            std::max< std::size_t >( reqs.size(), 1 ) * sizeof( npb_data_list ),
+            alignof( npb_data_list ) );
+        if ( entries == nullptr )
+                co_return false;
+        for ( std::size_t i = 0; i < reqs.size(); ++i ) {
+                std::size_t n = 0;
+                if ( !pb_get_encoded_size( &n, hub_to_unit_fields, &reqs[i] ) )
+                        co_return false;
+                auto* p = (uint8_t*) mem.allocate( n, 1 );
+                if ( p == nullptr )
+                        co_return false;
+                npb_ostream_ctx octx{ .buff = std::span{ p, n } };
+                pb_ostream_t    stream = npb_ostream_from( octx );
+                if ( !pb_encode( &stream, hub_to_unit_fields, &reqs[i] ) ) {
+                        spdlog::error( "Encoding error: {}", PB_GET_ERROR( &stream ) );
+                        co_return false;
+                }
+                entries[i] = npb_data_list{
+                    .data = { .data = p, .size = (uint32_t) stream.bytes_written },
+                    .next = i + 1 < reqs.size() ? &entries[i + 1] : nullptr,
+                };
+        }
+
+        hub_to_unit msg    = hub_to_unit_init_default;
+        msg.req_id         = c.next_req_id();
+        msg.which_sub      = hub_to_unit_batch_tag;
+        msg.sub.batch.msgs = reqs.empty() ? nullptr : entries;
+
+        auto res = co_await (
+            c.transact( msg.req_id, hub_to_unit_fields, &msg ) | ecor::err_to_val |
+            ecor::as_variant );
+        auto* repl = std::get_if< cobs_receiver::reply >( &res );
+        if ( repl == nullptr ) {
+                spdlog::error( "Batch transaction error" );
+                co_return false;
+        }
+        npb_istream_ctx ictx{ .buff = repl->data, .mem = mem };
+        pb_istream_t    istream = npb_istream_from( ictx );
+        unit_to_hub     batch   = {};
+        if ( !pb_decode( &istream, unit_to_hub_fields, &batch ) ||
+             batch.which_sub != unit_to_hub_batch_tag ) {
+                spdlog::error( "Invalid reply to batch" );
+                co_return false;
+        }
+
+        std::size_t i = 0;
+        for ( npb_data_list* e = batch.sub.batch.msgs; e != nullptr; e = e->next, ++i ) {
+                if ( i == reqs.size() )
+                        co_return false;
+                npb_istream_ctx ectx{ .buff = { e->data.data, e->data.size }, .mem = mem };
+                pb_istream_t    es = npb_istream_from( ectx );
+                resps[i]           = {};
+                if ( e->data.size == 0 || !pb_decode( &es, unit_to_hub_fields, &resps[i] ) ) {
+                        spdlog::error( "Request {} of batch failed", i );
+                        co_return false;
+                }
+        }
+        co_return i == reqs.size();
+}
+
+}  // namespace trctl
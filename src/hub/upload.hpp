@@ -0,0 +1,214 @@
+#pragma once
+
+#include "../server.hpp"
+#include "../task.hpp"
+#include "iface.hpp"
+#include "transact.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <optional>
+
+namespace trctl
+{
+
+// Data phase of a file upload. Keeps up to `window` file_transfer_data requests in flight and
+// slides the window by the cumulative acknowledgement (`acked`) of the unit. Throughput is bound by
+// chunk_size * window / RTT, the largest window covers a gigabit link with 20 ms RTT.
+struct file_upload
+{
+        static constexpr std::size_t chunk_size = max_transfer_chunk;
+        static constexpr std::size_t max_window = max_transfer_window;
+
+        server_client&             client;
+        uint32_t                   seq;
+        std::span< uint8_t const > data;
+        uint32_t                   window = 1;
+
+        uint64_t    next_offset = 0;
+        uint64_t    acked       = 0;
+        std::size_t in_flight   = 0;
+        bool        failed      = false;
+
+        file_upload( server_client& c, uint32_t seq, std::span< uint8_t const > data )
+          : client( c )
+          , seq( seq )
+          , data( data )
+        {
+        }
+
+        file_upload( file_upload const& )            = delete;
+        file_upload& operator=( file_upload const& ) = delete;
+        file_upload( file_upload&& )                 = delete;
+        file_upload& operator=( file_upload&& )      = delete;
+
+        struct _slot;
+
+        struct _chunk_recv
+        {
+                using receiver_concept = ecor::receiver_t;
+
+                file_upload* up;
+                _slot*       slot;
+
+                void set_value( cobs_receiver::reply r ) noexcept
+                {
+                        up->_on_reply( *slot, r.data );
+                }
+
+                void set_error( cobs_receiver::err ) noexcept
+                {
+                        up->_on_reply( *slot, {} );
+                }
+
+                void set_stopped() noexcept
+                {
+                        up->_on_reply( *slot, {} );
+                }
+        };
+
+        struct _slot
+        {
+                std::optional< server_client::_transact_op< _chunk_recv > > op;
+                bool                                                          busy = false;
+                // encoded into the frame once sent, the chunk data stays in `data`
+                hub_to_unit msg;
+        };
+
+        /// Whenever next chunk can be sent without exceeding the window
+        [[nodiscard]] bool can_send() const
+        {
+                if ( failed || in_flight >= window || next_offset >= data.size() )
+                        return false;
+                // the unit rejects chunks ending past the window
+                auto const n = std::min< uint64_t >( chunk_size, data.size() - next_offset );
+                return next_offset + n <= acked + window * chunk_size;
+        }
+
+        /// Sends the next chunk, completion of any chunk is signaled by `done()`
+        void send_next()
+        {
+                // in_flight < window <= max_window and one more slot covers `_replying`
+                auto& s = *std::ranges::find_if( _slots, [this]( _slot const& x ) {
+                        return !x.busy && &x != _replying;
+                } );
+
+                auto const n = std::min< uint64_t >( chunk_size, data.size() - next_offset );
+
+                file_transfer_data ftd = {};
+                ftd.offset             = next_offset;
+                ftd.data.data          = (uint8_t*) data.data() + next_offset;
+                ftd.data.size          = n;
+                s.msg                  = hub_to_unit_init_default;
+                set_sub( s.msg, std::move( ftd ), seq );
+                s.msg.req_id = client.next_req_id();
+
+                next_offset += n;
+                ++in_flight;
+                s.busy = true;
+                s.op.emplace(
+                    &client,
+                    s.msg.req_id,
+                    server_client::_payload{ hub_to_unit_fields, &s.msg },
+                    _chunk_recv{ this, &s } );
+                s.op->start();
+        }
+
+        auto done()
+        {
+                return _done.schedule();
+        }
+
+        void _on_reply( _slot& s, std::span< uint8_t const > repl )
+        {
+                s.busy = false;
+                --in_flight;
+
+                uint8_t                buffer[256];
+                circular_buffer_memory mem{ std::span{ buffer } };
+                npb_istream_ctx        ictx{ .buff = repl, .mem = mem };
+                pb_istream_t           istream = npb_istream_from( ictx );
+                unit_to_hub            msg     = {};
+                if ( repl.empty() || !pb_decode( &istream, unit_to_hub_fields, &msg ) ||
+                     msg.which_sub != unit_to_hub_file_tag || !msg.sub.file.success ) {
+                        spdlog::error( "Chunk of transfer {} failed", seq );
+                        failed = true;
+                } else {
+                        acked = std::max( acked, msg.sub.file.acked );
+                        for ( pb_size_t i = 0; i < msg.sub.file.gaps_count; ++i )
+                                spdlog::debug(
+                                    "Transfer {} gap: {}+{}",
+                                    seq,
+                                    msg.sub.file.gaps[i].offset,
+                                    msg.sub.file.gaps[i].size );
+                }
+                // the waiting coroutine sends more from within this call while the op of `s` is
+                // still on the stack, so `s` is skipped until another reply. Replies completing
+                // within those sends are failures that stop sending, `s` stays untouched.
+                _replying = &s;
+                _done.set_value();
+        }
+
+private:
+        std::array< _slot, max_window + 1 >           _slots;
+        _slot*                                        _replying = nullptr;
+        ecor::broadcast_source< ecor::set_value_t() > _done;
+};
+
+/// Sends all data of `up` and waits for all requests in flight, returns true if the unit
+/// acknowledged the whole file.
+inline ecor::task< bool > upload_data( task_ctx&, file_upload& up )
+{
+        up.window = std::clamp< uint32_t >( up.window, 1, file_upload::max_window );
+        for ( ;; ) {
+                while ( up.can_send() )
+                        up.send_next();
+                if ( up.in_flight == 0 )
+                        break;
+                co_await up.done();
+        }
+        co_return !up.failed && up.acked == up.data.size();
+}
+
+/// Uploads `data` as `folder/filename` to the unit, asking for the largest window the hub
+/// supports.
+inline ecor::task< bool > upload_file(
+    task_ctx&                  ctx,
+    server_client&             c,
+    uint32_t                   seq,
+    char const*                folder,
+    char const*                filename,
+    std::span< uint8_t const > data )
+{
+        hub_to_unit         msg   = hub_to_unit_init_default;
+        file_transfer_start start = file_transfer_start_init_default;
+        start.filename            = filename;
+        std::strncpy( start.folder, folder, sizeof( start.folder ) - 1 );
+        start.filesize = data.size();
+        start.window   = file_upload::max_window;
+        set_sub( msg, std::move( start ), seq );
+
+        unit_to_hub resp = co_await transact( ctx, c, msg );
+        if ( resp.which_sub != unit_to_hub_file_tag || !resp.sub.file.success ) {
+                spdlog::error( "Unit refused transfer of {}/{}", folder, filename );
+                co_return false;
+        }
+
+        file_upload up{ c, seq, data };
+        up.window = resp.sub.file.window;
+        if ( !co_await upload_data( ctx, up ) ) {
+                spdlog::error(
+                    "Transfer of {}/{} failed at offset {}", folder, filename, up.acked );
+                co_return false;
+        }
+
+        fnv1a hasher;
+        hasher( data );
+        msg = hub_to_unit_init_default;
+        set_sub( msg, file_transfer_end{ .fnv1a = hasher.hash }, seq );
+        resp = co_await transact( ctx, c, msg );
+        co_return resp.which_sub == unit_to_hub_file_tag && resp.sub.file.success;
+}
+
+}  // namespace trctl
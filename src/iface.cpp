@@ -45,7 +45,7 @@ list_folders_resp_callback( pb_istream_t* istream, pb_ostream_t* ostream, pb_fie
 extern "C" bool
 task_start_req_callback( pb_istream_t* istream, pb_ostream_t* ostream, pb_field_t const* field )
 {
-        if ( field->tag == task_start_req_args_tag )
+        if ( field->tag == task_start_req_args_tag || field->tag == task_start_req_env_tag )
                 return npb_handle_repeated_string_field( istream, ostream, field );
         else
                 return pb_default_field_callback( istream, ostream, field );
@@ -64,5 +64,43 @@ task_progress_resp_callback( pb_istream_t* istream, pb_ostream_t* ostream, pb_fi
                 return pb_default_field_callback( istream, ostream, field );
 }
 
+extern "C" bool
+task_output_callback( pb_istream_t* istream, pb_ostream_t* ostream, pb_field_t const* field )
+{
+        if ( field->tag == task_output_sout_tag || field->tag == task_output_serr_tag ) {
+                auto res = npb_handle_data_field( istream, ostream, field );
+                if ( istream )
+                        *(pb_size_t*) field->pSize = field->tag;
+                return res;
+        } else
+                return pb_default_field_callback( istream, ostream, field );
+}
+
+extern "C" bool
+task_read_resp_callback( pb_istream_t* istream, pb_ostream_t* ostream, pb_field_t const* field )
+{
+        if ( field->tag == task_read_resp_data_tag )
+                return npb_handle_data_field( istream, ostream, field );
+        else
+                return pb_default_field_callback( istream, ostream, field );
+}
+
+extern "C" bool
+hub_to_unit_batch_callback( pb_istream_t* istream, pb_ostream_t* ostream, pb_field_t const* field )
+{
+        if ( field->tag == hub_to_unit_batch_msgs_tag )
+                return npb_handle_repeated_data_field( istream, ostream, field );
+        else
+                return pb_default_field_callback( istream, ostream, field );
+}
+
+extern "C" bool
+unit_to_hub_batch_callback( pb_istream_t* istream, pb_ostream_t* ostream, pb_field_t const* field )
+{
+        if ( field->tag == unit_to_hub_batch_msgs_tag )
+                return npb_handle_repeated_data_field( istream, ostream, field );
+        else
+                return pb_default_field_callback( istream, ostream, field );
+}
 
 }  // namespace trctl
\ No newline at end of file
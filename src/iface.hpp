@@ -2,12 +2,27 @@
 
 #include "npb.hpp"
 
+#include <cstddef>
+#include <cstdint>
 #include <iface.pb.h>
 #include <utility>
 
 namespace trctl
 {
 
+/// Largest data of one file_transfer_data request. A full window of chunks covers the
+/// bandwidth-delay product of a gigabit link with 20 ms RTT, while a single chunk still fits the
+/// receive buffer of the unit and the memory of the task slot decoding it.
+inline constexpr std::size_t max_transfer_chunk = 1024 * 48;
+
+/// Largest window the unit grants, kept under the requests a hub connection can have in flight so
+/// that other requests still get through during an upload.
+inline constexpr uint32_t max_transfer_window = 48;
+
+/// Largest unit_to_hub message the hub receives. Replies of a batch that would take the reply
+/// past it fail instead.
+inline constexpr std::size_t max_unit_message = 1024 * 16;
+
 inline void set_get_init( hub_to_unit& msg )
 {
         msg.which_sub = hub_to_unit_init_tag;
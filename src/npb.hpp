@@ -79,6 +79,42 @@ inline npb_ostream_ctx* ctx_of( pb_ostream_t* ostream )
         return (npb_ostream_ctx*) ostream->state;
 }
 
+inline bool npb_cobs_ostream_cb( pb_ostream_t* ostream, pb_byte_t const* buf, size_t count )
+{
+        return ( (cobs_encoder*) ostream->state )->insert( { buf, count } );
+}
+
+/// Stream of at most `max_size` bytes feeding `enc`, encodes a message straight into a frame
+inline pb_ostream_t npb_cobs_ostream_from( cobs_encoder& enc, std::size_t max_size )
+{
+        pb_ostream_t stream{
+            .callback      = &npb_cobs_ostream_cb,
+            .state         = &enc,
+            .max_size      = max_size,
+            .bytes_written = 0,
+            .errmsg        = nullptr,
+        };
+        return stream;
+}
+
+/// Encodes `msg` directly into a frame of `tx`, the frame is sized by pb_get_encoded_size()
+inline send_status npb_send( frame_sender& tx, pb_msgdesc_t const* fields, void const* msg )
+{
+        std::size_t n = 0;
+        if ( !pb_get_encoded_size( &n, fields, msg ) ) {
+                spdlog::error( "Failed to size message" );
+                return send_status::ENCODING_ERROR;
+        }
+        return tx.send_encoded( n, [&]( cobs_encoder& enc ) {
+                pb_ostream_t stream = npb_cobs_ostream_from( enc, n );
+                if ( !pb_encode( &stream, fields, msg ) ) {
+                        spdlog::error( "Encoding error: {}", PB_GET_ERROR( &stream ) );
+                        return false;
+                }
+                return true;
+        } );
+}
+
 // ---------------------------------------------------------------------------
 
 inline bool
@@ -188,5 +224,50 @@ npb_handle_data_field( pb_istream_t* istream, pb_ostream_t* ostream, pb_field_t
         return false;
 }
 
+inline bool npb_handle_repeated_data_field(
+    pb_istream_t*     istream,
+    pb_ostream_t*     ostream,
+    pb_field_t const* field )
+{
+        if ( ostream ) {
+                npb_data_list* d = *(npb_data_list**) field->pData;
+                for ( ; d != nullptr; d = d->next ) {
+                        if ( !pb_encode_tag_for_field( ostream, field ) )
+                                return false;
+
+                        bool const ok =
+                            d->msg ? pb_encode_submessage( ostream, d->fields, d->msg ) :
+                                     pb_encode_string( ostream, d->data.data, d->data.size );
+                        if ( !ok )
+                                return false;
+                }
+                return true;
+        }
+        if ( istream ) {
+                npb_istream_ctx* ctx = ctx_of( istream );
+                npb_data_list**  trg = (npb_data_list**) field->pData;
+                while ( ( *trg ) )
+                        trg = &( ( *trg )->next );
+
+                auto* pp = ctx->mem.allocate( sizeof( npb_data_list ), alignof( npb_data_list ) );
+                if ( !pp )
+                        return false;
+                *trg = new ( pp ) npb_data_list{
+                    .data = { .data = nullptr, .size = 0 },
+                    .next = nullptr,
+                };
+
+                auto* p = (pb_byte_t*) ctx->mem.allocate( istream->bytes_left, 1 );
+                if ( !p && istream->bytes_left != 0 )
+                        return false;
+
+                ( *trg )->data = { .data = p, .size = (uint32_t) istream->bytes_left };
+                if ( !pb_read( istream, p, istream->bytes_left ) )
+                        return false;
+
+                return true;
+        }
+        return false;
+}
 
 }  // namespace trctl
\ No newline at end of file
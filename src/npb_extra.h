@@ -12,4 +12,15 @@ struct npb_str
 {
         char const*     str;
         struct npb_str* next;
+};
+
+struct pb_msgdesc_s;
+
+struct npb_data_list
+{
+        struct npb_data       data;
+        struct npb_data_list* next;
+        // when set, `msg` of type `fields` is encoded in place of `data`
+        struct pb_msgdesc_s const* fields;
+        void const*                msg;
 };
\ No newline at end of file
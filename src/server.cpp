@@ -1,5 +1,7 @@
 #include "server.hpp"
 
+#include <pb_decode.h>
+
 namespace trctl
 {
 namespace
@@ -9,31 +11,48 @@ namespace
         {
                 auto& c = *(server_client*) ( handle->data );
                 spdlog::info( "Client disconnected: {}:{}", c.ip, c.port );
-                c.server._remove_client( c );
+                if ( auto& st = c.gate.get_stats(); st.blocked != 0 )
+                        spdlog::info(
+                            "Writes to {}:{} blocked {} times for {} ms",
+                            c.ip,
+                            c.port,
+                            st.blocked,
+                            st.blocked_ns / 1'000'000 );
+                auto& tx = c.tx_stats();
+                spdlog::debug(
+                    "Sent {} frames to {}:{}, {} directly, rest in {} writes",
+                    tx.frames,
+                    c.ip,
+                    c.port,
+                    tx.direct,
+                    tx.writes );
+                c._fail_pending();
+                uv_close( (uv_handle_t*) &c.timer, []( uv_handle_t* handle ) {
+                        auto& c = *(server_client*) ( handle->data );
+                        c.server._remove_client( c );
+                } );
         }
 
 
-        void server_client_read( uv_stream_t* client, ssize_t nread, uv_buf_t const* buf )
+        void server_client_read( uv_stream_t* client, ssize_t nread, uv_buf_t const* )
         {
                 auto& c = *(server_client*) ( client->data );
                 if ( nread > 0 )
-                        c._handle_rx( { (uint8_t*) buf->base, (std::size_t) nread } );
+                        c._commit_rx( (std::size_t) nread );
                 if ( nread < 0 ) {
                         if ( nread != UV_EOF )
                                 spdlog::error( "Read error {}", uv_err_name( nread ) );
                         uv_close( (uv_handle_t*) client, server_client_close );
                 }
-
-                free( buf->base );
         }
 
 
-        void server_client_alloc( uv_handle_t*, size_t suggested_size, uv_buf_t* buf )
+        void server_client_alloc( uv_handle_t* handle, size_t, uv_buf_t* buf )
         {
-                // auto& c = *(server_client*) ( handle->data );
-                // XXX: should use memory pool from client instead
-                buf->base = (char*) malloc( suggested_size );
-                buf->len  = suggested_size;
+                auto& c   = *(server_client*) ( handle->data );
+                auto  w   = c._rx_window();
+                buf->base = (char*) w.data();
+                buf->len  = w.size();
         }
         void server_new_conn( uv_stream_t* srv, int status )
         {
@@ -54,24 +73,224 @@ namespace
                             (uv_stream_t*) &c.tcp, server_client_alloc, server_client_read );
                 } else {
                         spdlog::error( "Accepting new connection error {}", uv_strerror( status ) );
+                        uv_close( (uv_handle_t*) &c.timer, nullptr );
                         uv_close( (uv_handle_t*) &c.tcp, []( uv_handle_t* handle ) {
                                 auto& c = *(server_client*) ( handle->data );
                                 c.server._drop_client( c );
                         } );
                 }
         }
+
+        void server_shard_wake( uv_async_t* handle )
+        {
+                auto& sh = *(server_shards::_shard*) handle->data;
+
+                std::vector< std::function< void( server& ) > > fs;
+                {
+                        std::lock_guard lk{ sh.mtx };
+                        fs.swap( sh.posted );
+                }
+                for ( auto& f : fs )
+                        f( sh.srv );
+        }
 }  // namespace
 
-int server_init( server& s, uv_loop_t* loop, int port )
+server_client::server_client( struct server& s )
+  : server( s )
+{
+        tcp.data            = this;
+        timer.data          = this;
+        gate.high_watermark = 8 * 1024;
+        gate.low_watermark  = 2 * 1024;
+        _tx.pool            = &s.frames;
+        uv_timer_init( s.loop, &timer );
+}
+
+bool server_client::_register( _pending_iface& p )
+{
+        auto*& slot = _slot( p.req_id );
+        if ( slot ) {
+                spdlog::error(
+                    "Request {} collides with request {} in flight", p.req_id, slot->req_id );
+                return false;
+        }
+        slot       = &p;
+        p.deadline = uv_now( timer.loop ) + transact_timeout;
+        // all requests share the timeout, so the earliest deadline changes only for the first one
+        if ( _pending_n++ == 0 )
+                _arm_timer();
+        return true;
+}
+
+void server_client::_unregister( _pending_iface& p )
+{
+        auto*& slot = _slot( p.req_id );
+        if ( slot != &p )
+                return;
+        slot = nullptr;
+        if ( --_pending_n == 0 )
+                uv_timer_stop( &timer );
+}
+
+void server_client::_on_reply( std::span< uint8_t const > data )
+{
+        // msg_header is a prefix of unit_to_hub, everything except req_id gets skipped
+        msg_header   h = msg_header_init_zero;
+        pb_istream_t s = pb_istream_from_buffer( data.data(), data.size() );
+        if ( !pb_decode( &s, msg_header_fields, &h ) ) {
+                spdlog::error( "Failed to decode reply header: {}", PB_GET_ERROR( &s ) );
+                return;
+        }
+        if ( h.req_id == 0 ) {
+                _pushed.set_value( cobs_receiver::reply{ .data = data } );
+                return;
+        }
+        auto* p = _slot( h.req_id );
+        if ( !p || p->req_id != h.req_id ) {
+                spdlog::warn(
+                    "Dropping reply to unknown request {} from {}:{}", h.req_id, ip, port );
+                return;
+        }
+        _unregister( *p );
+        p->set_value( cobs_receiver::reply{ .data = data } );
+}
+
+void server_client::_on_timeout()
+{
+        uint64_t const now = uv_now( timer.loop );
+        // completion might start new transactions, these have deadline in the future
+        for ( auto*& slot : _pending ) {
+                if ( !slot || slot->deadline > now )
+                        continue;
+                auto* p = std::exchange( slot, nullptr );
+                --_pending_n;
+                spdlog::warn( "Request {} to {}:{} timed out", p->req_id, ip, port );
+                p->set_error( cobs_receiver::err{} );
+        }
+        _arm_timer();
+}
+
+void server_client::_fail_pending()
+{
+        for ( auto*& slot : _pending ) {
+                if ( !slot )
+                        continue;
+                auto* p = std::exchange( slot, nullptr );
+                --_pending_n;
+                p->set_error( cobs_receiver::err{} );
+        }
+        uv_timer_stop( &timer );
+}
+
+void server_client::_arm_timer()
+{
+        if ( _pending_n == 0 ) {
+                uv_timer_stop( &timer );
+                return;
+        }
+        uint64_t deadline = UINT64_MAX;
+        for ( auto* p : _pending )
+                if ( p )
+                        deadline = std::min( deadline, p->deadline );
+        uint64_t const now = uv_now( timer.loop );
+        uv_timer_start(
+            &timer,
+            []( uv_timer_t* handle ) {
+                    ( (server_client*) handle->data )->_on_timeout();
+            },
+            deadline > now ? deadline - now : 0,
+            0 );
+}
+
+int server_init( server& s, uv_loop_t* loop, int port, unsigned bind_flags )
 {
         s.loop = loop;
         uv_tcp_init( loop, &s.tcp );
 
         uv_ip4_addr( "0.0.0.0", port, &s.addr );
 
-        uv_tcp_bind( &s.tcp, (const struct sockaddr*) &s.addr, 0 );
+        if ( int e = uv_tcp_bind( &s.tcp, (const struct sockaddr*) &s.addr, bind_flags ); e )
+                return e;
         spdlog::info( "Starting new server on port {}", port );
         return uv_listen( (uv_stream_t*) &s.tcp, server::backlog, trctl::server_new_conn );
 }
 
+int server_init( server_shards& s, int port, std::size_t n )
+{
+        for ( std::size_t i = 0; i < n; ++i ) {
+                auto& sh = *s._shards.emplace_back( std::make_unique< server_shards::_shard >() );
+                uv_loop_init( &sh.loop );
+                sh.wake.data     = &sh;
+                sh.srv.directory = &s._directory;
+                sh.srv.shard_id  = i;
+                uv_async_init( &sh.loop, &sh.wake, server_shard_wake );
+                // all shards have to bind the port the first one got
+                if ( int e = server_init( sh.srv, &sh.loop, port, UV_TCP_REUSEPORT ); e )
+                        return e;
+                if ( port == 0 )
+                        port = get_connection_info( &sh.srv.tcp, sock_kind::SOCK ).port;
+        }
+        s._port = port;
+        for ( auto& sh : s._shards )
+                sh->thread = std::thread{ [&loop = sh->loop] {
+                        uv_run( &loop, UV_RUN_DEFAULT );
+                } };
+        spdlog::info( "Running {} server shards on port {}", n, port );
+        return 0;
+}
+
+server_shards::~server_shards()
+{
+        stop();
+        for ( auto& sh : _shards ) {
+                uv_walk(
+                    &sh->loop,
+                    []( uv_handle_t* h, void* ) {
+                            if ( !uv_is_closing( h ) )
+                                    uv_close( h, nullptr );
+                    },
+                    nullptr );
+                uv_run( &sh->loop, UV_RUN_DEFAULT );
+                uv_loop_close( &sh->loop );
+        }
+}
+
+void server_shards::post( std::size_t i, std::function< void( server& ) > f )
+{
+        auto& sh = *_shards[i];
+        {
+                std::lock_guard lk{ sh.mtx };
+                sh.posted.push_back( std::move( f ) );
+        }
+        uv_async_send( &sh.wake );
+}
+
+bool server_shards::with_unit( std::string const& mac, std::function< void( server_client* ) > f )
+{
+        auto i = _directory.find( mac );
+        if ( !i )
+                return false;
+        post( *i, [mac, f = std::move( f )]( server& s ) {
+                f( s.find_client( mac ) );
+        } );
+        return true;
+}
+
+void server_shards::stop()
+{
+        for ( std::size_t i = 0; i < _shards.size(); ++i )
+                if ( _shards[i]->thread.joinable() )
+                        post( i, []( server& s ) {
+                                uv_stop( s.loop );
+                        } );
+        join();
+}
+
+void server_shards::join()
+{
+        for ( auto& sh : _shards )
+                if ( sh->thread.joinable() )
+                        sh->thread.join();
+}
+
 }  // namespace trctl
\ No newline at end of file
@@ -1,16 +1,27 @@
 #pragma once
 
 #include "./util.hpp"
+#include "./util/slab_pool.hpp"
 #include "cobs.hpp"
 #include "ecor/ecor.hpp"
+#include "iface.hpp"
 #include "iface.pb.h"
+#include "npb.hpp"
 
+#include <array>
 #include <cstdint>
+#include <functional>
 #include <iostream>
-#include <list>
+#include <memory>
 #include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <string_view>
 #include <sys/types.h>
+#include <thread>
+#include <unordered_map>
 #include <uv.h>
+#include <vector>
 
 namespace trctl
 {
@@ -20,43 +31,180 @@ struct server;
 
 struct server_client
 {
+        // requests are routed by `req_id % max_inflight`, at most this many can be in flight
+        static constexpr std::size_t max_inflight = 64;
+        // largest encoded frame the unit can send, COBS adds a byte per 254 and the delimiter
+        static constexpr std::size_t rx_size = max_unit_message + max_unit_message / 254 + 2;
+
         server&     server;
         uv_tcp_t    tcp;
+        uv_timer_t  timer;
         std::string ip;
         int         port = 0;
+        /// Address the unit reported in its init message, empty until server::bind_mac()
+        std::string mac_addr;
+        /// Transactions wait here while writes to the unit pile up. Frames stay in `_mem` until
+        /// they are written, so the watermarks are well below its size.
+        write_gate gate{ (uv_stream_t*) &tcp };
 
+        /// Transactions without reply after this many milliseconds fail with an error
+        uint64_t transact_timeout = 30'000;
 
-        server_client( struct server& s, std::span< uint8_t > rx_buffer )
-          : server( s )
-          , _recv( rx_buffer )
-        {
-                tcp.data = this;
-        }
+        server_client( struct server& s );
 
         server_client( server_client const& )            = delete;
         server_client& operator=( server_client const& ) = delete;
         server_client( server_client&& )                 = delete;
         server_client& operator=( server_client&& )      = delete;
 
+        /// Returns request id that does not collide with any of the transactions in flight. Zero
+        /// is never used, it marks messages pushed by the unit.
+        uint64_t next_req_id()
+        {
+                for ( std::size_t i = 0; i < max_inflight; ++i ) {
+                        uint64_t const id = _next_req_id++;
+                        if ( id != 0 && !_slot( id ) )
+                                return id;
+                }
+                return _next_req_id++;
+        }
+
+        /// Completes with the next message the unit pushes on its own. `data` of the message is
+        /// valid only until the receiver returns.
+        auto pushed()
+        {
+                return _pushed.schedule();
+        }
+
+        /// Request of a transaction, either encoded already or a message encoded into its frame
+        struct _payload
+        {
+                std::span< uint8_t const > data;
+                pb_msgdesc_t const*        fields = nullptr;
+                void const*                msg    = nullptr;
+
+                _payload( std::span< uint8_t const > d )
+                  : data( d )
+                {
+                }
+
+                _payload( pb_msgdesc_t const* f, void const* m )
+                  : fields( f )
+                  , msg( m )
+                {
+                }
+        };
+
         struct _transact_sender;
 
-        _transact_sender transact( std::span< uint8_t const > data )
+        /// Sends `data` and completes once a reply with the same `req_id` arrives. Multiple
+        /// transactions can be in flight at once, `data` has to stay valid until completion.
+        _transact_sender transact( uint64_t req_id, std::span< uint8_t const > data )
         {
-                return { this, data };
+                return { this, req_id, data };
         }
 
+        /// Same as above, but `msg` is encoded straight into the frame once it is sent
+        _transact_sender transact( uint64_t req_id, pb_msgdesc_t const* fields, void const* msg )
+        {
+                return { this, req_id, { fields, msg } };
+        }
+
+        struct _pending_iface
+        {
+                uint64_t req_id   = 0;
+                uint64_t deadline = 0;
+
+                virtual void set_value( cobs_receiver::reply ) = 0;
+                virtual void set_error( cobs_receiver::err )   = 0;
+        };
 
-        template < typename ChildOp >
-        struct _transact_op
+        template < typename R >
+        struct _transact_op : _pending_iface, write_waiter
         {
-                server_client*             _client;
-                std::span< uint8_t const > _data;
-                ChildOp                    _child_op;
+                using operation_state_concept = ecor::operation_state_t;
+
+                server_client* _client;
+                _payload       _data;
+                R              _recv;
+                // set from start() until completion, the op is linked in the client and its gate
+                bool                                           _active = false;
+                std::optional< stop_callback< _transact_op > > _stop;
+
+                _transact_op( server_client* c, uint64_t id, _payload d, R r )
+                  : _client( c )
+                  , _data( d )
+                  , _recv( std::move( r ) )
+                {
+                        this->req_id = id;
+                }
+
+                _transact_op( _transact_op const& )            = delete;
+                _transact_op& operator=( _transact_op const& ) = delete;
+
+                // an op destroyed before completion must not be found by a late reply or timeout
+                ~_transact_op()
+                {
+                        if ( _active )
+                                _unlink();
+                }
 
+                // time spent waiting for the gate counts towards the timeout of the transaction
                 void start()
                 {
-                        _child_op.start();
-                        _client->_send( _data );
+                        auto token = stop_token_of( _recv );
+                        if ( token.stop_requested() ) {
+                                _recv.set_stopped();
+                                return;
+                        }
+                        if ( !_client->_register( *this ) ) {
+                                _recv.set_error( cobs_receiver::err{} );
+                                return;
+                        }
+                        _active = true;
+                        _stop.emplace( token, stop_hook< _transact_op >{ this } );
+                        if ( _client->gate.blocked() )
+                                _client->gate.wait( *this );
+                        else
+                                _write();
+                }
+
+                void on_writable() override
+                {
+                        _write();
+                }
+
+                void on_stop()
+                {
+                        _unlink();
+                        _recv.set_stopped();
+                }
+
+                void set_value( cobs_receiver::reply r ) override
+                {
+                        _unlink();
+                        _stop.reset();
+                        _recv.set_value( r );
+                }
+
+                void set_error( cobs_receiver::err e ) override
+                {
+                        _unlink();
+                        _stop.reset();
+                        _recv.set_error( e );
+                }
+
+                void _write()
+                {
+                        if ( _client->_send( _data ) != send_status::SUCCESS )
+                                set_error( cobs_receiver::err{} );
+                }
+
+                void _unlink()
+                {
+                        _active = false;
+                        _client->_unregister( *this );
+                        _client->gate.cancel( *this );
                 }
         };
 
@@ -64,13 +212,15 @@ struct server_client
         {
                 using sender_concept = ecor::sender_t;
 
-                server_client*             _client;
-                std::span< uint8_t const > _data;
+                server_client* _client;
+                uint64_t       _req_id;
+                _payload       _data;
 
                 template < typename Env >
                 using completion_signatures = ecor::completion_signatures<
                     ecor::set_value_t( cobs_receiver::reply ),
-                    ecor::set_error_t( cobs_receiver::err ) >;
+                    ecor::set_error_t( cobs_receiver::err ),
+                    ecor::set_stopped_t() >;
 
                 template < typename Env >
                 completion_signatures< Env > get_completion_signatures( Env&& )
@@ -81,37 +231,96 @@ struct server_client
                 template < typename R >
                 auto connect( R rec ) noexcept
                 {
-                        return _transact_op{
-                            _client,
-                            _data,
-                            _client->_recv.recv_src.schedule().connect( std::move( rec ) ) };
+                        return _transact_op< R >{ _client, _req_id, _data, std::move( rec ) };
                 }
         };
 
-        void _send( std::span< uint8_t const > data )
+        send_status _send( _payload const& p )
         {
-                auto status = cobs_send( _mem, &this->tcp, data );
-                switch ( status ) {
-                case send_status::ENCODING_ERROR:
-                        _recv.recv_src.set_error( cobs_receiver::err{} );
-                        return;
-                case send_status::WRITE_ERROR:
-                        _recv.recv_src.set_error( cobs_receiver::err{} );
-                        return;
-                case send_status::SUCCESS:
-                        break;
-                }
+                return p.fields ? npb_send( _tx, p.fields, p.msg ) : _tx.send( p.data );
+        }
+
+        frame_sender::stats const& tx_stats() const
+        {
+                return _tx.get_stats();
         }
 
-        void _handle_rx( std::span< uint8_t const > data )
+        std::span< uint8_t > _rx_window()
         {
-                _recv._handle_rx( data );
+                return _recv.rx_window();
         }
 
+        void _commit_rx( std::size_t n )
+        {
+                _recv._commit_rx( n, [this]( std::span< uint8_t const > d ) {
+                        _on_reply( d );
+                } );
+        }
+
+        bool _register( _pending_iface& p );
+        void _unregister( _pending_iface& p );
+        void _on_reply( std::span< uint8_t const > data );
+        void _on_timeout();
+        /// Fails all transactions in flight, used once the connection is closed.
+        void _fail_pending();
+
 private:
-        uint8_t                _buffer[1024 * 4];
+        _pending_iface*& _slot( uint64_t req_id )
+        {
+                return _pending[req_id % max_inflight];
+        }
+
+        void _arm_timer();
+
+        // memory of a request frame written on its own
+        static constexpr std::size_t _request_footprint =
+            frame_sender::frame_footprint( 128 ) + frame_sender::write_footprint();
+
+        // frames stay allocated until they are written, room for all in flight
+        uint8_t                _buffer[1024 * 4 + max_inflight * _request_footprint];
         circular_buffer_memory _mem{ std::span{ _buffer } };
-        cobs_receiver          _recv;
+        frame_sender           _tx{ (uv_stream_t*) &tcp, _mem, gate };
+        uint8_t                _rx[rx_size];
+        cobs_receiver          _recv{ std::span{ _rx } };
+
+        std::array< _pending_iface*, max_inflight > _pending{};
+        std::size_t                                 _pending_n   = 0;
+        uint64_t                                    _next_req_id = 1;
+
+        ecor::broadcast_source< ecor::set_value_t( cobs_receiver::reply ) > _pushed;
+};
+
+
+/// Shard owning the connection of each unit, shared by servers running in different threads
+struct unit_directory
+{
+        void set( std::string const& mac, std::size_t shard )
+        {
+                std::lock_guard lk{ _mtx };
+                _shard_of[mac] = shard;
+        }
+
+        /// Forgets `mac` unless the unit has meanwhile reconnected to another shard
+        void erase( std::string const& mac, std::size_t shard )
+        {
+                std::lock_guard lk{ _mtx };
+                auto            iter = _shard_of.find( mac );
+                if ( iter != _shard_of.end() && iter->second == shard )
+                        _shard_of.erase( iter );
+        }
+
+        std::optional< std::size_t > find( std::string const& mac )
+        {
+                std::lock_guard lk{ _mtx };
+                auto            iter = _shard_of.find( mac );
+                if ( iter == _shard_of.end() )
+                        return std::nullopt;
+                return iter->second;
+        }
+
+private:
+        std::mutex                                     _mtx;
+        std::unordered_map< std::string, std::size_t > _shard_of;
 };
 
 
@@ -123,6 +332,12 @@ struct server
         sockaddr_in addr;
         uv_loop_t*  loop;
         uv_tcp_t    tcp;
+        /// Set for servers of server_shards, bound addresses are published there
+        unit_directory* directory = nullptr;
+        std::size_t     shard_id  = 0;
+        /// Large frames of all clients, like file transfer chunks, declared before the clients so
+        /// that it outlives them
+        buffer_pool frames;
 
         server()
         {
@@ -154,22 +369,54 @@ struct server
                 return _disc_event.schedule();
         }
 
+        /// Makes the client reachable through find_client() under `mac`. A unit that
+        /// reconnects before its old connection is noticed as closed replaces it in the index.
+        void bind_mac( server_client& client, std::string_view mac )
+        {
+                _unbind_mac( client );
+                client.mac_addr          = mac;
+                _by_mac[client.mac_addr] = &client;
+                if ( directory )
+                        directory->set( client.mac_addr, shard_id );
+        }
+
+        /// Connection of the unit with `mac`, nullptr if there is none
+        server_client* find_client( std::string_view mac )
+        {
+                auto iter = _by_mac.find( std::string{ mac } );
+                return iter == _by_mac.end() ? nullptr : iter->second;
+        }
+
+        std::size_t client_count() const
+        {
+                return _clients.size();
+        }
+
+        /// Calls `f` with every connected client
+        template < typename F >
+        void for_each_client( F&& f )
+        {
+                _clients.for_each( (F&&) f );
+        }
+
+        /// Heap memory held for client connections, including the free slots
+        std::size_t client_memory() const
+        {
+                return _clients.reserved_bytes();
+        }
+
         void _remove_client( server_client& client )
         {
                 _disc_event.set_value( client_disconnected{ .client = client } );
-                _clients.remove_if( [&client]( auto& other ) {
-                        return &other == &client;
-                } );
+                _drop_client( client );
         }
 
         server_client& _new_client()
         {
-                static constexpr std::size_t rx_size = 4096 + 128;
-                auto*                        mem     = _mem.allocate( rx_size, 1 );
-                if ( !mem )
+                auto* c = _clients.make( *this );
+                if ( !c )
                         throw std::bad_alloc();
-                return _clients.emplace_back(
-                    *this, std::span< uint8_t >{ (uint8_t*) mem, rx_size } );
+                return *c;
         }
 
         void _commit_client( server_client& client )
@@ -179,24 +426,91 @@ struct server
 
         void _drop_client( server_client& client )
         {
-                _clients.remove_if( [&client]( auto& other ) {
-                        return &other == &client;
-                } );
+                _unbind_mac( client );
+                _clients.destroy( &client );
         }
 
 private:
-        uint8_t                _buffer[64 * sizeof( server_client )];
-        circular_buffer_memory _mem{ std::span{ _buffer } };
+        void _unbind_mac( server_client& client )
+        {
+                if ( client.mac_addr.empty() )
+                        return;
+                auto iter = _by_mac.find( client.mac_addr );
+                if ( iter != _by_mac.end() && iter->second == &client ) {
+                        _by_mac.erase( iter );
+                        if ( directory )
+                                directory->erase( client.mac_addr, shard_id );
+                }
+                client.mac_addr.clear();
+        }
 
-        using allocator = ecor::circular_buffer_allocator< server_client, uint64_t, dealloc_iface >;
-        using list      = std::list< server_client, allocator >;
-        list _clients{ allocator{ _mem } };
+        slab_pool< server_client >                        _clients;
+        std::unordered_map< std::string, server_client* > _by_mac;
 
         ecor::broadcast_source< ecor::set_value_t( new_client ) >          _new_event;
         ecor::broadcast_source< ecor::set_value_t( client_disconnected ) > _disc_event;
 };
 
 
-int server_init( server& s, uv_loop_t* loop, int port );
+/// Servers listening on the same port, each running its own loop in its own thread. Every shard
+/// binds with SO_REUSEPORT and the kernel spreads incoming connections across them, clients stay
+/// on the shard that accepted them. Other threads reach a shard only through post().
+struct server_shards
+{
+        server_shards() = default;
+
+        server_shards( server_shards const& )            = delete;
+        server_shards& operator=( server_shards const& ) = delete;
+
+        ~server_shards();
+
+        std::size_t size() const
+        {
+                return _shards.size();
+        }
+
+        /// Port all shards listen on, resolved in case zero was passed to server_init()
+        int port() const
+        {
+                return _port;
+        }
+
+        /// Runs `f` with the server of shard `i` in the thread of that shard. Safe to call from
+        /// any thread, functions posted before the threads are started run once they are.
+        void post( std::size_t i, std::function< void( server& ) > f );
+
+        /// Runs `f` in the thread of the shard holding the connection of unit `mac`, with the
+        /// connection or nullptr in case it was closed meanwhile. Returns false if no shard knows
+        /// the unit.
+        bool with_unit( std::string const& mac, std::function< void( server_client* ) > f );
+
+        /// Stops loops of all shards and waits for their threads
+        void stop();
+
+        /// Waits until loops of all shards finish
+        void join();
+
+        struct _shard
+        {
+                uv_loop_t   loop;
+                server      srv;
+                uv_async_t  wake;
+                std::thread thread;
+
+                std::mutex                                      mtx;
+                std::vector< std::function< void( server& ) > > posted;
+        };
+
+        std::vector< std::unique_ptr< _shard > > _shards;
+        unit_directory                           _directory;
+        int                                      _port = 0;
+};
+
+
+/// `bind_flags` are passed to uv_tcp_bind()
+int server_init( server& s, uv_loop_t* loop, int port, unsigned bind_flags = 0 );
+
+/// Starts `n` shards listening on `port`, each in its own thread
+int server_init( server_shards& s, int port, std::size_t n );
 
 }  // namespace trctl
\ No newline at end of file
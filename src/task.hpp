@@ -4,6 +4,7 @@
 
 #include <ecor/ecor.hpp>
 #include <list>
+#include <new>
 
 namespace trctl
 {
@@ -17,27 +18,53 @@ struct task_cfg
 template < typename T >
 using task = ecor::task< T, task_cfg >;
 
+// Core is woken up on demand: the idle handle is armed only when some operation gets rescheduled,
+// so uv_run() can block in poll once there is no pending work. ecor reaches the core through the
+// get_task_core_t query, which yields this type, so its reschedule() is the one called.
 struct task_core : public ecor::task_core
 {
-        uv_loop_t* loop;
-        uv_idle_t  idle;
+        uv_loop_t*  loop;
+        uv_idle_t   idle;
+        std::size_t pending = 0;
 
         task_core( uv_loop_t* l )
           : loop( l )
         {
                 idle.data = this;
                 uv_idle_init( loop, &idle );
-                uv_idle_start(
-                    &idle, +[]( uv_idle_t* handle ) {
-                            auto& self = *static_cast< task_core* >( handle->data );
-                            self.run_once();
-                    } );
+        }
+
+        task_core( task_core const& )            = delete;
+        task_core& operator=( task_core const& ) = delete;
+
+        void reschedule( ecor::_itask_op& op )
+        {
+                ecor::task_core::reschedule( op );
+                if ( pending++ == 0 )
+                        uv_idle_start( &idle, &task_core::_on_idle );
+        }
+
+        [[nodiscard]] bool is_armed() const
+        {
+                return uv_is_active( (uv_handle_t const*) &idle );
         }
 
         ~task_core()
         {
                 uv_idle_stop( &idle );
         }
+
+private:
+        static void _on_idle( uv_idle_t* handle )
+        {
+                auto& self = *static_cast< task_core* >( handle->data );
+                // operations rescheduled while running increment `pending` again and keep the
+                // handle armed for the next iteration
+                for ( auto n = std::exchange( self.pending, 0 ); n > 0; --n )
+                        self.run_once();
+                if ( self.pending == 0 )
+                        uv_idle_stop( &self.idle );
+        }
 };
 
 class task_ctx
@@ -79,6 +106,8 @@ struct comp_buff
         uint8_t buffer[1024 * 16];
 };
 
+// Component with tick() executed on demand, whenever schedule_tick() was called since the last
+// tick.
 struct component : task_ctx, zll::ll_base< component >
 {
         uv_idle_t idle;
@@ -88,9 +117,14 @@ struct component : task_ctx, zll::ll_base< component >
         {
                 idle.data = this;
                 uv_idle_init( loop, &idle );
+        }
+
+        void schedule_tick()
+        {
                 uv_idle_start(
                     &idle, +[]( uv_idle_t* handle ) {
                             auto& self = *static_cast< component* >( handle->data );
+                            uv_idle_stop( handle );
                             self.tick();
                     } );
         }
@@ -121,6 +155,7 @@ struct task_slots : comp_buff, component
                         return &x == &slot;
                 } );
                 _finished_slots.link_back( slot );
+                schedule_tick();
         }
 
         void tick() override
@@ -128,11 +163,24 @@ struct task_slots : comp_buff, component
                 clear_slots( _finished_slots );
         }
 
-        void emplace_slot( uv_loop_t* loop, auto&& f )
+        /// Returns false when no slot could be allocated for `f`
+        bool emplace_slot( uv_loop_t* loop, auto&& f )
         {
-                auto* slot = new task_slot< N, M >( loop, *this, f );
+                static_assert( alignof( task_slot< N, M > ) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__ );
+                // slots are large, memory of finished ones is reused instead of a malloc each
+                void* p = _spare;
+                if ( p ) {
+                        _spare = _spare->next;
+                        --_spare_n;
+                } else {
+                        p = ::operator new( sizeof( task_slot< N, M > ), std::nothrow );
+                }
+                if ( !p )
+                        return false;
+                auto* slot = new ( p ) task_slot< N, M >( loop, *this, f );
                 _slots.link_back( *slot );
                 slot->start();
+                return true;
         }
 
         task_slots( uv_loop_t* l, task_core& c )
@@ -152,18 +200,44 @@ struct task_slots : comp_buff, component
         ~task_slots()
         {
                 clear_slots( _finished_slots );
+                while ( _spare ) {
+                        auto* n = _spare->next;
+                        ::operator delete( _spare );
+                        _spare = n;
+                }
+        }
+
+        /// Memory of up to this many finished slots is kept for the next requests
+        std::size_t max_spare = 8;
+
+        std::size_t spare_count() const
+        {
+                return _spare_n;
         }
 
 private:
+        struct _spare_node
+        {
+                _spare_node* next;
+        };
+
         zll::ll_list< task_slot< N, M > > _slots;
         zll::ll_list< task_slot< N, M > > _finished_slots;
+        _spare_node*                      _spare   = nullptr;
+        std::size_t                       _spare_n = 0;
 
         void clear_slots( auto& s )
         {
                 while ( !s.empty() ) {
                         auto& slot = s.take_front();
                         spdlog::debug( "Deleting {}", (void*) &slot );
-                        delete &slot;
+                        slot.~task_slot();
+                        if ( _spare_n < max_spare ) {
+                                _spare = new ( &slot ) _spare_node{ _spare };
+                                ++_spare_n;
+                        } else {
+                                ::operator delete( &slot );
+                        }
                 }
         }
 };
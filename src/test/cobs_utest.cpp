@@ -0,0 +1,225 @@
+#include "../cobs.hpp"
+#include "../util.hpp"
+
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+namespace trctl
+{
+
+std::vector< uint8_t > encode_frame( std::vector< uint8_t > const& data )
+{
+        std::vector< uint8_t > res( data.size() + data.size() / 254 + 2 );
+        auto [succ, used] = encode_cobs( data, res );
+        EXPECT_TRUE( succ );
+        res.resize( used.size() );
+        res.push_back( 0 );
+        return res;
+}
+
+// Byte by byte reference, the block based encode_cobs() has to match it bit by bit
+std::tuple< bool, std::vector< uint8_t > >
+ref_encode( std::vector< uint8_t > const& data, std::size_t capacity )
+{
+        std::vector< uint8_t > res( capacity );
+        cobs_encoder           e( res );
+        for ( uint8_t b : data )
+                if ( !e.insert( b ) )
+                        return { false, {} };
+        auto used = std::move( e ).commit();
+        res.resize( used.size() );
+        return { true, res };
+}
+
+std::vector< uint8_t > ref_decode( std::span< uint8_t const > data )
+{
+        std::vector< uint8_t > res;
+        cobs_decoder           dec( data.front() );
+        for ( uint8_t b : data.subspan( 1 ) )
+                if ( auto v = dec.iter( b ) )
+                        res.push_back( *v );
+        return res;
+}
+
+std::vector< std::vector< uint8_t > > cobs_samples()
+{
+        std::mt19937                          gen( 42 );
+        std::vector< std::vector< uint8_t > > res;
+        for ( std::size_t n : { 0, 1, 2, 253, 254, 255, 256, 507, 508, 509, 1000, 4096 } ) {
+                std::vector< uint8_t > rnd( n ), sparse( n ), nz( n );
+                for ( std::size_t i = 0; i < n; ++i ) {
+                        rnd[i]    = gen() % 4 == 0 ? 0 : gen();
+                        sparse[i] = gen() % 300 == 0 ? 0 : 1 + gen() % 255;
+                        nz[i]     = 1 + gen() % 255;
+                }
+                res.push_back( rnd );
+                res.push_back( sparse );
+                res.push_back( nz );
+                res.push_back( std::vector< uint8_t >( n, 0 ) );
+        }
+        return res;
+}
+
+TEST( cobs, encode_matches_reference )
+{
+        for ( auto const& data : cobs_samples() ) {
+                std::size_t const cap = data.size() + data.size() / 254 + 3;
+
+                auto [ref_succ, ref] = ref_encode( data, cap );
+                ASSERT_TRUE( ref_succ );
+
+                std::vector< uint8_t > out( cap );
+                auto [succ, used] = encode_cobs( data, out );
+                ASSERT_TRUE( succ );
+                EXPECT_EQ( std::vector< uint8_t >( used.begin(), used.end() ), ref );
+
+                // capacity limits have to match as well
+                for ( std::size_t c = std::max< std::size_t >( ref.size() - 1, 2 );
+                      c <= ref.size() + 1;
+                      ++c ) {
+                        std::vector< uint8_t > small( c );
+                        auto [s1, u1] = encode_cobs( data, small );
+                        auto [s2, u2] = ref_encode( data, c );
+                        EXPECT_EQ( s1, s2 ) << "size: " << data.size() << " capacity: " << c;
+                }
+        }
+}
+
+TEST( cobs, bulk_insert_matches_reference )
+{
+        for ( auto const& data : cobs_samples() ) {
+                std::size_t const cap = data.size() + data.size() / 254 + 3;
+
+                auto [ref_succ, ref] = ref_encode( data, cap );
+                ASSERT_TRUE( ref_succ );
+
+                // as a stream encoder it gets the data in pieces of any size
+                for ( std::size_t chunk : { 1, 7, 254, 300, 5000 } ) {
+                        std::vector< uint8_t > out( cap );
+                        cobs_encoder           e( out );
+
+                        std::span< uint8_t const > rest{ data };
+                        while ( !rest.empty() ) {
+                                auto n = std::min( chunk, rest.size() );
+                                ASSERT_TRUE( e.insert( rest.first( n ) ) );
+                                rest = rest.subspan( n );
+                        }
+                        auto used = std::move( e ).commit();
+                        EXPECT_EQ( std::vector< uint8_t >( used.begin(), used.end() ), ref )
+                            << "size: " << data.size() << " chunk: " << chunk;
+                }
+
+                // capacity limits match the byte by byte insertion
+                for ( std::size_t c = std::max< std::size_t >( ref.size() - 1, 2 );
+                      c <= ref.size() + 1;
+                      ++c ) {
+                        std::vector< uint8_t > small( c );
+                        cobs_encoder           e( small );
+                        auto [s2, u2] = ref_encode( data, c );
+                        EXPECT_EQ( e.insert( data ), s2 )
+                            << "size: " << data.size() << " capacity: " << c;
+                }
+        }
+}
+
+TEST( cobs, decode_matches_reference )
+{
+        for ( auto const& data : cobs_samples() ) {
+                auto enc = encode_frame( data );
+                enc.pop_back();
+
+                std::vector< uint8_t > out( enc.size() );
+                auto [succ, used] = decode_cobs( enc, out );
+                ASSERT_TRUE( succ );
+                EXPECT_EQ( std::vector< uint8_t >( used.begin(), used.end() ), data );
+                EXPECT_EQ( ref_decode( enc ), data );
+
+                // in place
+                auto [succ2, used2] = decode_cobs( enc, enc );
+                ASSERT_TRUE( succ2 );
+                EXPECT_EQ( std::vector< uint8_t >( used2.begin(), used2.end() ), data );
+        }
+}
+
+
+struct rx_collector
+{
+        std::vector< std::vector< uint8_t > > frames;
+
+        void operator()( std::span< uint8_t > d )
+        {
+                frames.emplace_back( d.begin(), d.end() );
+        }
+};
+
+TEST( cobs_receiver, burst_of_small_frames )
+{
+        uint8_t       buffer[256];
+        cobs_receiver recv{ buffer };
+        rx_collector  col;
+
+        std::vector< uint8_t > stream;
+        for ( uint8_t i = 0; i < 40; ++i ) {
+                auto f = encode_frame( { i, 0, uint8_t( i + 1 ) } );
+                stream.insert( stream.end(), f.begin(), f.end() );
+        }
+        recv._handle_rx( stream, [&]( std::span< uint8_t > d ) {
+                col( d );
+        } );
+
+        ASSERT_EQ( col.frames.size(), 40u );
+        for ( uint8_t i = 0; i < 40; ++i )
+                EXPECT_EQ( col.frames[i], ( std::vector< uint8_t >{ i, 0, uint8_t( i + 1 ) } ) );
+        EXPECT_EQ( recv.rx_used, 0u );
+}
+
+TEST( cobs_receiver, frames_split_across_reads )
+{
+        uint8_t       buffer[64];
+        cobs_receiver recv{ buffer };
+        rx_collector  col;
+
+        std::vector< uint8_t > payload( 40 );
+        for ( std::size_t i = 0; i < payload.size(); ++i )
+                payload[i] = uint8_t( i % 5 );
+        auto f = encode_frame( payload );
+
+        std::vector< uint8_t > stream;
+        for ( std::size_t k = 0; k < 10; ++k )
+                stream.insert( stream.end(), f.begin(), f.end() );
+
+        // reads not aligned with frames, incomplete frames have to be moved on wrap
+        std::span< uint8_t const > data{ stream };
+        while ( !data.empty() ) {
+                auto n = std::min< std::size_t >( 25, data.size() );
+                recv._handle_rx( data.subspan( 0, n ), [&]( std::span< uint8_t > d ) {
+                        col( d );
+                } );
+                data = data.subspan( n );
+        }
+
+        ASSERT_EQ( col.frames.size(), 10u );
+        for ( auto& x : col.frames )
+                EXPECT_EQ( x, payload );
+}
+
+TEST( cobs_receiver, oversized_frame_is_dropped )
+{
+        uint8_t       buffer[32];
+        cobs_receiver recv{ buffer };
+        rx_collector  col;
+
+        std::vector< uint8_t > stream = encode_frame( std::vector< uint8_t >( 100, 1 ) );
+        auto                   small  = encode_frame( { 1, 2, 3 } );
+        stream.insert( stream.end(), small.begin(), small.end() );
+
+        recv._handle_rx( stream, [&]( std::span< uint8_t > d ) {
+                col( d );
+        } );
+
+        ASSERT_EQ( col.frames.size(), 1u );
+        EXPECT_EQ( col.frames[0], ( std::vector< uint8_t >{ 1, 2, 3 } ) );
+}
+
+}  // namespace trctl
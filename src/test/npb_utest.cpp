@@ -1,8 +1,10 @@
 
 #include "iface.hpp"
 
+#include <algorithm>
 #include <cstddef>
 #include <gtest/gtest.h>
+#include <vector>
 
 namespace trctl
 {
@@ -49,4 +51,47 @@ TEST( npb, base )
             msg.sub.file_transfer.sub.start.filename, msg2.sub.file_transfer.sub.start.filename );
 }
 
+TEST( npb, cobs_stream_matches_encode_cobs )
+{
+        uint8_t                buffer[1024 * 16];
+        circular_buffer_memory mem{ std::span{ buffer } };
+
+        // long runs with and without zeros, so that both the run limit and the zeros are hit
+        std::vector< uint8_t > data( 3000 );
+        for ( std::size_t i = 0; i < data.size(); ++i )
+                data[i] = i % 700 < 400 ? uint8_t( 1 + i % 251 ) : uint8_t( i % 3 );
+
+        hub_to_unit        msg = hub_to_unit_init_default;
+        file_transfer_data ftd = {};
+        ftd.offset             = 4096;
+        ftd.data.data          = data.data();
+        ftd.data.size          = data.size();
+        set_sub( msg, std::move( ftd ), 7 );
+        msg.req_id = 42;
+
+        std::size_t n = 0;
+        ASSERT_TRUE( pb_get_encoded_size( &n, hub_to_unit_fields, &msg ) );
+        auto*           p = (uint8_t*) mem.allocate( n, 1 );
+        npb_ostream_ctx octx{ .buff = std::span{ p, n } };
+        pb_ostream_t    ostream = npb_ostream_from( octx );
+        ASSERT_TRUE( pb_encode( &ostream, hub_to_unit_fields, &msg ) );
+
+        std::vector< uint8_t > expected( 3 + n * 258 / 255 );
+        auto [succ, used] = encode_cobs( std::span{ p, n }, std::span{ expected } );
+        ASSERT_TRUE( succ );
+
+        std::vector< uint8_t > out( 3 + n * 258 / 255 );
+        cobs_encoder           enc{ std::span{ out } };
+        pb_ostream_t           cstream = npb_cobs_ostream_from( enc, n );
+        ASSERT_TRUE( pb_encode( &cstream, hub_to_unit_fields, &msg ) );
+        EXPECT_EQ( cstream.bytes_written, n );
+        auto res = std::move( enc ).commit();
+        EXPECT_TRUE( std::ranges::equal( res, used ) );
+
+        // the size limit of the stream is enforced
+        cobs_encoder enc2{ std::span{ out } };
+        pb_ostream_t short_stream = npb_cobs_ostream_from( enc2, n - 1 );
+        EXPECT_FALSE( pb_encode( &short_stream, hub_to_unit_fields, &msg ) );
+}
+
 }  // namespace trctl
\ No newline at end of file
@@ -1,14 +1,28 @@
 
 #include "../src/client.hpp"
+#include "../src/hub/transact.hpp"
+#include "../src/hub/upload.hpp"
 #include "../src/server.hpp"
+#include "../src/unit/unit.hpp"
 #include "../src/util.hpp"
 #include "./tutil.hpp"
 #include "ecor/ecor.hpp"
 #include "uv.h"
 
+#include <algorithm>
 #include <array>
 #include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <future>
 #include <gtest/gtest.h>
+#include <memory>
+#include <numeric>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
 
 namespace std
 {
@@ -135,15 +149,16 @@ TEST( server, one_interaction )
                         auto* e = std::get_if< server::new_client >( &evt );
                         if ( !e )
                                 std::abort();
-                        std::array< uint8_t, 4 > buff = { 1, 2, 3, 4 };
+                        // msg_header with req_id = 1
+                        std::array< uint8_t, 2 > buff = { 0x10, 1 };
                         spdlog::info( "Starting test transaction" );
                         auto res = co_await (
-                            e->client.transact( buff ) | ecor::err_to_val | ecor::as_variant );
+                            e->client.transact( 1, buff ) | ecor::err_to_val | ecor::as_variant );
                         if ( std::get_if< cobs_receiver::err >( &res ) )
                                 std::abort();
                         auto& prom = std::get< cobs_receiver::reply >( res );
 
-                        std::array< uint8_t, 4 > expected = { 5, 6, 7, 8 };
+                        std::array< uint8_t, 4 > expected = { 0x10, 1, 0x18, 8 };
                         EXPECT_EQ( prom.data, std::span< uint8_t const >{ expected } );
                         ++fired_counter;
                 }
@@ -152,13 +167,14 @@ TEST( server, one_interaction )
         h1.start();
 
         auto client_coro = [&fired_counter, &client]( test_ctx& ctx ) -> ecor::task< void > {
-                std::array< uint8_t, 4 > buff = { 5, 6, 7, 8 };
+                // same req_id followed by unknown field 3
+                std::array< uint8_t, 4 > buff = { 0x10, 1, 0x18, 8 };
                 auto res = co_await ( client.incoming() | ecor::err_to_val | ecor::as_variant );
                 spdlog::info( "Got incoming data" );
                 if ( std::get_if< cobs_receiver::err >( &res ) )
                         std::abort();
                 auto&                    prom     = std::get< client::promise >( res );
-                std::array< uint8_t, 4 > expected = { 1, 2, 3, 4 };
+                std::array< uint8_t, 2 > expected = { 0x10, 1 };
                 EXPECT_EQ( prom.data, std::span< uint8_t const >{ expected } );
                 std::ignore = prom.fullfill( buff );
                 ++fired_counter;
@@ -173,4 +189,883 @@ TEST( server, one_interaction )
 }
 
 
+// Request with msg_header{ req_id = id }, the reply carries extra field 3 with `id + 100`
+std::array< uint8_t, 2 > req_frame( uint8_t id )
+{
+        return { 0x10, id };
+}
+
+std::array< uint8_t, 4 > reply_frame( uint8_t id )
+{
+        return { 0x10, id, 0x18, uint8_t( id + 100 ) };
+}
+
+struct pipelined_req
+{
+        server_client&           c;
+        uint8_t                  id;
+        std::array< uint8_t, 2 > buff = req_frame( id );
+        bool                     done = false;
+
+        ecor::task< void > run( test_ctx& )
+        {
+                auto res = co_await (
+                    c.transact( id, buff ) | ecor::err_to_val | ecor::as_variant );
+                auto* repl = std::get_if< cobs_receiver::reply >( &res );
+                EXPECT_TRUE( repl ) << "req_id: " << (int) id;
+                if ( repl )
+                        EXPECT_EQ( repl->data, std::span< uint8_t const >{ reply_frame( id ) } );
+                done = true;
+        }
+};
+
+TEST( server, pipelined_transactions )
+{
+        static constexpr uint8_t reqs_n = 32;
+
+        server   server;
+        client   client;
+        test_ctx ctx;
+
+        server_client* sc = nullptr;
+        auto           h  = [&]( test_ctx& ) -> ecor::task< void > {
+                auto e = co_await server.new_event();
+                sc     = &e.client;
+        }( ctx ).connect( ecor::_dummy_receiver{} );
+        h.start();
+
+        // unit side collects all requests first and replies in reverse order
+        std::vector< uint8_t > received;
+        auto unit = [&]( test_ctx& ) -> ecor::task< void > {
+                for ( uint8_t i = 0; i < reqs_n; ++i ) {
+                        auto prom = co_await client.incoming();
+                        EXPECT_EQ( prom.data.size(), 2u );
+                        received.push_back( prom.data[1] );
+                }
+                for ( auto it = received.rbegin(); it != received.rend(); ++it ) {
+                        auto repl = reply_frame( *it );
+                        EXPECT_EQ( client.tx.send( repl ), send_status::SUCCESS );
+                }
+        }( ctx ).connect( ecor::_dummy_receiver{} );
+        unit.start();
+
+        init_both( ctx.loop, server, client );
+        while ( !sc )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+
+        std::vector< std::unique_ptr< pipelined_req > > reqs;
+        using op_t = ecor::connect_type< ecor::task< void >, ecor::_dummy_receiver >;
+        std::vector< std::unique_ptr< op_t > > ops;
+        for ( uint8_t i = 1; i <= reqs_n; ++i ) {
+                auto& r = *reqs.emplace_back( new pipelined_req{ .c = *sc, .id = i } );
+                auto& o = *ops.emplace_back(
+                    new op_t( r.run( ctx ).connect( ecor::_dummy_receiver{} ) ) );
+                o.start();
+        }
+
+        auto all_done = [&] {
+                return std::ranges::all_of( reqs, []( auto& r ) {
+                        return r->done;
+                } );
+        };
+        uint64_t const start = uv_hrtime();
+        while ( !all_done() && uv_hrtime() - start < 5'000'000'000 )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+
+        EXPECT_TRUE( all_done() );
+        EXPECT_EQ( received.size(), reqs_n );
+
+        uv_close( (uv_handle_t*) &client, nullptr );
+        uv_close( (uv_handle_t*) &server.tcp, nullptr );
+        run_loop( ctx.loop, 20 );
+}
+
+TEST( server, transaction_timeout )
+{
+        server   server;
+        client   client;
+        test_ctx ctx;
+
+        server_client* sc = nullptr;
+        auto           h  = [&]( test_ctx& ) -> ecor::task< void > {
+                auto e = co_await server.new_event();
+                sc     = &e.client;
+        }( ctx ).connect( ecor::_dummy_receiver{} );
+        h.start();
+
+        init_both( ctx.loop, server, client );
+        while ( !sc )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+        sc->transact_timeout = 10;
+
+        // unit never replies
+        bool timed_out = false;
+        auto buff      = req_frame( 1 );
+        auto t         = [&]( test_ctx& ) -> ecor::task< void > {
+                auto res = co_await (
+                    sc->transact( 1, buff ) | ecor::err_to_val | ecor::as_variant );
+                timed_out = std::holds_alternative< cobs_receiver::err >( res );
+        }( ctx ).connect( ecor::_dummy_receiver{} );
+        t.start();
+
+        uint64_t const start = uv_hrtime();
+        while ( !timed_out && uv_hrtime() - start < 1'000'000'000 )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+        EXPECT_TRUE( timed_out );
+
+        // late reply to the orphaned request is dropped, slot can be reused
+        auto late = reply_frame( 1 );
+        EXPECT_EQ( client.tx.send( late ), send_status::SUCCESS );
+        run_loop( ctx.loop, 20 );
+        EXPECT_EQ( sc->next_req_id(), 1u );
+
+        uv_close( (uv_handle_t*) &client, nullptr );
+        uv_close( (uv_handle_t*) &server.tcp, nullptr );
+        run_loop( ctx.loop, 20 );
+}
+
+struct stop_env
+{
+        ecor::inplace_stop_token token;
+
+        auto query( ecor::get_stop_token_t ) const noexcept
+        {
+                return token;
+        }
+};
+
+struct stoppable_recv
+{
+        using receiver_concept = ecor::receiver_t;
+
+        ecor::inplace_stop_token token;
+        int*                     completed;
+        int*                     stopped;
+
+        void set_value( cobs_receiver::reply ) noexcept
+        {
+                ++*completed;
+        }
+
+        void set_value() noexcept
+        {
+                ++*completed;
+        }
+
+        void set_error( cobs_receiver::err ) noexcept
+        {
+                ++*completed;
+        }
+
+        void set_stopped() noexcept
+        {
+                ++*stopped;
+        }
+};
+
+stop_env get_env( stoppable_recv const& r ) noexcept
+{
+        return { r.token };
+}
+
+TEST( server, transaction_stopped_or_destroyed )
+{
+        server   server;
+        client   client;
+        test_ctx ctx;
+
+        server_client* sc = nullptr;
+        auto           h  = [&]( test_ctx& ) -> ecor::task< void > {
+                auto e = co_await server.new_event();
+                sc     = &e.client;
+        }( ctx ).connect( ecor::_dummy_receiver{} );
+        h.start();
+
+        init_both( ctx.loop, server, client );
+        while ( !sc )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+        sc->transact_timeout = 10;
+
+        ecor::inplace_stop_source src;
+        int                       completed = 0;
+        int                       stopped   = 0;
+        auto                      buff1     = req_frame( 1 );
+        auto                      buff2     = req_frame( 2 );
+        {
+                auto op = sc->transact( 1, buff1 ).connect(
+                    stoppable_recv{ src.get_token(), &completed, &stopped } );
+                op.start();
+                run_loop( ctx.loop, 10 );
+        }
+        auto op = sc->transact( 2, buff2 ).connect(
+            stoppable_recv{ src.get_token(), &completed, &stopped } );
+        op.start();
+        src.request_stop();
+        EXPECT_EQ( stopped, 1 );
+
+        // neither the timeout nor the late replies reach the destroyed or stopped op
+        uint64_t const start = uv_hrtime();
+        while ( uv_hrtime() - start < 50'000'000 )
+                uv_run( ctx.loop, UV_RUN_NOWAIT );
+        for ( uint8_t id : { 1, 2 } ) {
+                auto late = reply_frame( id );
+                EXPECT_EQ( client.tx.send( late ), send_status::SUCCESS );
+        }
+        run_loop( ctx.loop, 20 );
+        EXPECT_EQ( completed, 0 );
+        EXPECT_EQ( stopped, 1 );
+        EXPECT_EQ( sc->next_req_id(), 1u );
+        EXPECT_EQ( sc->next_req_id(), 2u );
+
+        uv_close( (uv_handle_t*) &client, nullptr );
+        uv_close( (uv_handle_t*) &server.tcp, nullptr );
+        run_loop( ctx.loop, 20 );
+}
+
+
+TEST( server, pushed_message )
+{
+        server   server;
+        client   client;
+        test_ctx ctx;
+
+        server_client* sc = nullptr;
+        auto           h  = [&]( test_ctx& ) -> ecor::task< void > {
+                auto e = co_await server.new_event();
+                sc     = &e.client;
+        }( ctx ).connect( ecor::_dummy_receiver{} );
+        h.start();
+
+        init_both( ctx.loop, server, client );
+        while ( !sc )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+
+        std::vector< uint8_t > got;
+        auto                   t = [&]( test_ctx& ) -> ecor::task< void > {
+                auto msg = co_await sc->pushed();
+                got.assign( msg.data.begin(), msg.data.end() );
+        }( ctx ).connect( ecor::_dummy_receiver{} );
+        t.start();
+
+        // no req_id, so zero, and field 3 that the header skips
+        std::array< uint8_t, 2 > push{ 0x18, 5 };
+        EXPECT_EQ( client.tx.send( push ), send_status::SUCCESS );
+        uint64_t const start = uv_hrtime();
+        while ( got.empty() && uv_hrtime() - start < 1'000'000'000 )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+        EXPECT_EQ( got, ( std::vector< uint8_t >{ 0x18, 5 } ) );
+
+        uv_close( (uv_handle_t*) &client, nullptr );
+        uv_close( (uv_handle_t*) &server.tcp, nullptr );
+        run_loop( ctx.loop, 20 );
+}
+
+
+struct rx_stats
+{
+        std::size_t frames = 0;
+        std::size_t bytes  = 0;
+};
+
+template < typename R >
+struct rx_counter_cb : R
+{
+        rx_counter_cb( R&& r, rx_stats& st )
+          : R( std::move( r ) )
+          , st( st )
+        {
+        }
+
+        void set_value( client::promise prom ) noexcept
+        {
+                st.frames += 1;
+                st.bytes += prom.data.size();
+                R::set_value();
+        }
+
+        rx_stats& st;
+};
+
+// Keeps rewriting the same chunk of pre-encoded frames until `left` writes were done
+struct chunk_writer : uv_write_t
+{
+        uv_buf_t    buf;
+        std::size_t left;
+
+        void start( uv_stream_t* stream )
+        {
+                uv_write( this, stream, &buf, 1, on_write );
+        }
+
+        static void on_write( uv_write_t* req, int status )
+        {
+                auto& w = *static_cast< chunk_writer* >( req );
+                EXPECT_GE( status, 0 ) << "Error: " << uv_strerror( status );
+                if ( status < 0 || --w.left == 0 )
+                        return;
+                w.start( req->handle );
+        }
+};
+
+TEST( server, rx_throughput )
+{
+        static constexpr std::size_t frame_size       = 4000;
+        static constexpr std::size_t frames_per_chunk = 16;
+        static constexpr std::size_t writers_n        = 4;
+        static constexpr std::size_t total            = 256 * 1024 * 1024;
+        static constexpr std::size_t chunks = total / ( frame_size * frames_per_chunk );
+
+        server   server;
+        client   client;
+        test_ctx ctx;
+
+        std::vector< uint8_t > payload( frame_size );
+        for ( std::size_t i = 0; i < payload.size(); ++i )
+                payload[i] = (uint8_t) ( i * 7 );
+        std::vector< uint8_t > enc( frame_size * 2 );
+        auto [succ, used] = encode_cobs( payload, enc );
+        ASSERT_TRUE( succ );
+        std::vector< uint8_t > chunk;
+        for ( std::size_t i = 0; i < frames_per_chunk; ++i ) {
+                chunk.insert( chunk.end(), used.begin(), used.end() );
+                chunk.push_back( 0 );
+        }
+
+        rx_stats st;
+        auto r = ecor::repeater( client.incoming() | ecor::then< rx_counter_cb, rx_stats& >( st ) );
+        r.start();
+
+        server_client* sc = nullptr;
+        auto           h  = [&]( test_ctx& ) -> ecor::task< void > {
+                auto e = co_await server.new_event();
+                sc     = &e.client;
+        }( ctx ).connect( ecor::_dummy_receiver{} );
+        h.start();
+
+        init_both( ctx.loop, server, client );
+        while ( !sc )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+
+        std::array< chunk_writer, writers_n > writers;
+        for ( auto& w : writers ) {
+                w.buf  = uv_buf_init( (char*) chunk.data(), chunk.size() );
+                w.left = chunks / writers_n;
+                w.start( (uv_stream_t*) &sc->tcp );
+        }
+
+        std::size_t const expected = writers_n * ( chunks / writers_n ) * frames_per_chunk;
+        uint64_t const    start    = uv_hrtime();
+        while ( st.frames < expected && uv_hrtime() - start < 60'000'000'000 )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+        double const ms = (double) ( uv_hrtime() - start ) / 1e6;
+
+        EXPECT_EQ( st.frames, expected );
+        EXPECT_EQ( st.bytes, expected * frame_size );
+        spdlog::info(
+            "Received {} MB in {:.1f} ms: {:.1f} MB/s",
+            st.bytes / ( 1024 * 1024 ),
+            ms,
+            (double) st.bytes / ( 1024 * 1024 ) / ( ms / 1000 ) );
+
+        uv_close( (uv_handle_t*) &client, nullptr );
+        uv_close( (uv_handle_t*) &server.tcp, nullptr );
+        run_loop( ctx.loop, 20 );
+}
+
+
+// Plain loopback connection, only the server side of it is exercised
+struct raw_conn
+{
+        uv_tcp_t     tcp;
+        uv_connect_t req;
+};
+
+struct raw_fleet
+{
+        // connects in flight, kept below the listen backlog so that no SYN has to be retried
+        static constexpr std::size_t window = server::backlog / 2;
+
+        uv_loop_t*                    loop;
+        sockaddr_in                   dest;
+        std::size_t                   n;
+        std::unique_ptr< raw_conn[] > conns = std::make_unique< raw_conn[] >( n );
+        std::size_t                   next  = 0;
+
+        void connect_next()
+        {
+                if ( next == n )
+                        return;
+                auto& c    = conns[next++];
+                c.req.data = this;
+                uv_tcp_init( loop, &c.tcp );
+                uv_tcp_connect( &c.req, &c.tcp, (sockaddr const*) &dest, on_connect );
+        }
+
+        static void on_connect( uv_connect_t* req, int status )
+        {
+                EXPECT_GE( status, 0 ) << "Error: " << uv_strerror( status );
+                ( (raw_fleet*) req->data )->connect_next();
+        }
+
+        void close_all()
+        {
+                for ( std::size_t i = 0; i < next; ++i )
+                        uv_close( (uv_handle_t*) &conns[i].tcp, nullptr );
+        }
+};
+
+TEST( server, many_clients )
+{
+        // both ends of every connection live in this process
+        rlimit lim;
+        ASSERT_EQ( getrlimit( RLIMIT_NOFILE, &lim ), 0 );
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit( RLIMIT_NOFILE, &lim );
+        std::size_t const n = std::min< std::size_t >( 10'000, ( lim.rlim_cur - 64 ) / 2 );
+
+        server   server;
+        test_ctx ctx;
+
+        std::vector< server_client* > clients;
+        std::size_t                   disconnected = 0;
+
+        auto h = [&]( test_ctx& ) -> ecor::task< void > {
+                for ( ;; ) {
+                        auto e = co_await (
+                            ( server.new_event() || server.disc_event() ) | ecor::as_variant );
+                        if ( auto* nc = std::get_if< server::new_client >( &e ) )
+                                clients.push_back( &nc->client );
+                        else
+                                ++disconnected;
+                }
+        }( ctx ).connect( ecor::_dummy_receiver{} );
+        h.start();
+
+        ASSERT_EQ( server_init( server, ctx.loop, 0 ), 0 );
+        auto [ip, port] = get_connection_info( &server.tcp, sock_kind::SOCK );
+
+        raw_fleet fleet{ .loop = ctx.loop, .n = n };
+        uv_ip4_addr( "127.0.0.1", port, &fleet.dest );
+
+        spdlog::set_level( spdlog::level::warn );
+        uint64_t const start = uv_hrtime();
+        for ( std::size_t i = 0; i < raw_fleet::window; ++i )
+                fleet.connect_next();
+        while ( clients.size() < n && uv_hrtime() - start < 60'000'000'000 )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+        double const ms = (double) ( uv_hrtime() - start ) / 1e6;
+        spdlog::set_level( spdlog::level::info );
+
+        ASSERT_EQ( clients.size(), n );
+        EXPECT_EQ( server.client_count(), n );
+        spdlog::info(
+            "Accepted {} clients in {:.1f} ms: {:.0f} per second, {} B per connection",
+            n,
+            ms,
+            (double) n / ( ms / 1000 ),
+            server.client_memory() / n );
+
+        server.bind_mac( *clients[0], "DE:AD:BE:EF:00:01" );
+        server.bind_mac( *clients[1], "DE:AD:BE:EF:00:02" );
+        EXPECT_EQ( server.find_client( "DE:AD:BE:EF:00:01" ), clients[0] );
+        EXPECT_EQ( server.find_client( "DE:AD:BE:EF:00:02" ), clients[1] );
+        EXPECT_EQ( server.find_client( "DE:AD:BE:EF:00:03" ), nullptr );
+        // reconnected unit takes over the address
+        server.bind_mac( *clients[2], "DE:AD:BE:EF:00:01" );
+        EXPECT_EQ( server.find_client( "DE:AD:BE:EF:00:01" ), clients[2] );
+
+        spdlog::set_level( spdlog::level::warn );
+        fleet.close_all();
+        while ( disconnected < n && uv_hrtime() - start < 120'000'000'000 )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+        spdlog::set_level( spdlog::level::info );
+
+        EXPECT_EQ( disconnected, n );
+        EXPECT_EQ( server.client_count(), 0u );
+        EXPECT_EQ( server.find_client( "DE:AD:BE:EF:00:01" ), nullptr );
+        EXPECT_EQ( server.find_client( "DE:AD:BE:EF:00:02" ), nullptr );
+
+        uv_close( (uv_handle_t*) &server.tcp, nullptr );
+        run_loop( ctx.loop, 20 );
+}
+
+
+TEST( server, write_backpressure )
+{
+        server   server;
+        test_ctx ctx;
+
+        server_client* sc = nullptr;
+        auto           h  = [&]( test_ctx& ) -> ecor::task< void > {
+                auto e = co_await server.new_event();
+                sc     = &e.client;
+        }( ctx ).connect( ecor::_dummy_receiver{} );
+        h.start();
+
+        ASSERT_EQ( server_init( server, ctx.loop, 0 ), 0 );
+        auto [ip, port] = get_connection_info( &server.tcp, sock_kind::SOCK );
+
+        // the peer does not read until the gate blocks
+        raw_fleet fleet{ .loop = ctx.loop, .n = 1 };
+        uv_ip4_addr( "127.0.0.1", port, &fleet.dest );
+        fleet.connect_next();
+        while ( !sc )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+
+        std::vector< uint8_t > payload( 1024, 0x55 );
+        for ( std::size_t i = 0; i < 1'000'000 && !sc->gate.blocked(); ++i ) {
+                ASSERT_EQ( sc->_send( payload ), send_status::SUCCESS );
+                uv_run( ctx.loop, UV_RUN_NOWAIT );
+        }
+        ASSERT_TRUE( sc->gate.blocked() );
+        EXPECT_GE( sc->gate.get_stats().max_queued, sc->gate.high_watermark );
+        // frames went out directly until the socket filled up, the rest got gathered
+        auto& tx = sc->tx_stats();
+        EXPECT_GT( tx.direct, 0u );
+        EXPECT_LT( tx.writes, tx.frames - tx.direct );
+
+        bool resumed = false;
+        auto w       = [&]( test_ctx& ) -> ecor::task< void > {
+                co_await sc->gate.writable();
+                resumed = true;
+        }( ctx ).connect( ecor::_dummy_receiver{} );
+        w.start();
+        run_loop( ctx.loop, 10 );
+        EXPECT_FALSE( resumed );
+
+        // waiters destroyed or stopped before the drain are not resumed by it
+        ecor::inplace_stop_source src;
+        int                       completed = 0;
+        int                       stopped   = 0;
+        {
+                auto gone = sc->gate.writable().connect(
+                    stoppable_recv{ src.get_token(), &completed, &stopped } );
+                gone.start();
+        }
+        auto waiting = sc->gate.writable().connect(
+            stoppable_recv{ src.get_token(), &completed, &stopped } );
+        waiting.start();
+        src.request_stop();
+        EXPECT_EQ( stopped, 1 );
+
+        static uint8_t sink[64 * 1024];
+        uv_read_start(
+            (uv_stream_t*) &fleet.conns[0].tcp,
+            []( uv_handle_t*, size_t, uv_buf_t* buf ) {
+                    *buf = uv_buf_init( (char*) sink, sizeof sink );
+            },
+            []( uv_stream_t*, ssize_t, uv_buf_t const* ) {} );
+        uint64_t const start = uv_hrtime();
+        while ( !resumed && uv_hrtime() - start < 10'000'000'000 )
+                uv_run( ctx.loop, UV_RUN_ONCE );
+
+        EXPECT_TRUE( resumed );
+        EXPECT_EQ( completed, 0 );
+        EXPECT_EQ( stopped, 1 );
+        EXPECT_FALSE( sc->gate.blocked() );
+        EXPECT_EQ( sc->gate.get_stats().blocked, 1u );
+        EXPECT_GT( sc->gate.get_stats().blocked_ns, 0u );
+
+        fleet.close_all();
+        uv_close( (uv_handle_t*) &server.tcp, nullptr );
+        run_loop( ctx.loop, 20 );
+}
+
+
+// Unit with its own work folder, running on the loop of the test and connected to a server
+struct local_unit
+{
+        test_ctx&             ctx;
+        std::filesystem::path workdir;
+        task_core             core{ ctx.loop };
+        unit_ctx              uctx{ ctx.loop, workdir, core };
+
+        std::optional< ecor::connect_type< task< void >, ecor::_dummy_receiver > > op;
+
+        local_unit( test_ctx& ctx, std::filesystem::path wd )
+          : ctx( ctx )
+          , workdir( std::move( wd ) )
+        {
+                std::filesystem::remove_all( workdir );
+                std::filesystem::create_directories( workdir );
+        }
+
+        void connect( server& srv )
+        {
+                auto [ip, port] = get_connection_info( &srv.tcp, sock_kind::SOCK );
+                op.emplace(
+                    unit_ctx_loop( ctx, uctx, "127.0.0.1", port )
+                        .connect( ecor::_dummy_receiver{} ) );
+                op->start();
+        }
+
+        // stops everything of `ctx` and waits until the unit is gone from `srv`
+        void stop( server& srv )
+        {
+                ctx.stop.request_stop();
+                uint64_t const start = uv_hrtime();
+                while ( srv.client_count() > 0 && uv_hrtime() - start < 10'000'000'000 )
+                        uv_run( ctx.loop, UV_RUN_ONCE );
+                EXPECT_EQ( srv.client_count(), 0u );
+                run_loop( ctx.loop, 128 );
+        }
+};
+
+// Runs the loop until `done` is set, at most for `ns`
+void run_until( uv_loop_t* loop, bool const& done, uint64_t ns = 10'000'000'000 )
+{
+        uint64_t const start = uv_hrtime();
+        while ( !done && uv_hrtime() - start < ns )
+                uv_run( loop, UV_RUN_ONCE );
+}
+
+TEST( server, upload_to_unit )
+{
+        server     server;
+        test_ctx   ctx;
+        local_unit unit{ ctx, "./_work_upload" };
+        std::filesystem::create_directories( unit.workdir / "up" );
+
+        // several chunks, the last one partial
+        std::vector< uint8_t > data( file_upload::chunk_size * 5 + 123 );
+        for ( std::size_t i = 0; i < data.size(); ++i )
+                data[i] = uint8_t( i * 7 + i / 251 );
+
+        uint8_t  hub_mem[1024 * 64];
+        task_ctx hub{ ctx.loop, ctx, std::span{ hub_mem } };
+        bool     done    = false;
+        bool     started = false;
+        bool     sent    = false;
+        bool     ended   = false;
+        uint32_t window  = 0;
+        uint64_t acked   = 0;
+
+        auto hub_coro = [&]( task_ctx& hub ) -> ecor::task< void > {
+                auto  e = co_await server.new_event();
+                auto& c = e.client;
+
+                hub_to_unit         msg   = hub_to_unit_init_default;
+                file_transfer_start start = file_transfer_start_init_default;
+                start.filename            = "data.bin";
+                std::strcpy( start.folder, "up" );
+                start.filesize = data.size();
+                start.window   = file_upload::max_window;
+                set_sub( msg, std::move( start ), 1 );
+                unit_to_hub resp = co_await transact( hub, c, msg );
+                started = resp.which_sub == unit_to_hub_file_tag && resp.sub.file.success;
+
+                file_upload up{ c, 1, data };
+                up.window = resp.sub.file.window;
+                window    = up.window;
+                sent      = co_await upload_data( hub, up );
+                acked     = up.acked;
+
+                fnv1a hasher;
+                hasher( data );
+                msg = hub_to_unit_init_default;
+                set_sub( msg, file_transfer_end{ .fnv1a = hasher.hash }, 1 );
+                resp  = co_await transact( hub, c, msg );
+                ended = resp.which_sub == unit_to_hub_file_tag && resp.sub.file.success;
+                done  = true;
+        };
+        auto h = hub_coro( hub ).connect( ecor::_dummy_receiver{} );
+        h.start();
+
+        ASSERT_EQ( server_init( server, ctx.loop, 0 ), 0 );
+        unit.connect( server );
+        run_until( ctx.loop, done );
+
+        EXPECT_TRUE( done );
+        EXPECT_TRUE( started );
+        EXPECT_GT( window, 1u );
+        EXPECT_TRUE( sent );
+        EXPECT_EQ( acked, data.size() );
+        EXPECT_TRUE( ended );
+
+        std::ifstream          f{ unit.workdir / "up" / "data.bin", std::ios::binary };
+        std::vector< uint8_t > written{ std::istreambuf_iterator< char >{ f }, {} };
+        EXPECT_TRUE( written == data );
+
+        // chunk frames are taken from the pool of the server and reused
+        auto const& ps = server.frames.get_stats();
+        EXPECT_GT( ps.acquired, 0u );
+        EXPECT_EQ( ps.acquired, ps.released );
+        EXPECT_LT( ps.mallocs, ps.acquired );
+
+        unit.stop( server );
+        uv_close( (uv_handle_t*) &server.tcp, nullptr );
+        run_loop( ctx.loop, 20 );
+}
+
+
+TEST( server, batch_to_unit )
+{
+        static constexpr std::size_t folders = 24;
+
+        server     server;
+        test_ctx   ctx;
+        local_unit unit{ ctx, "./_work_batch" };
+        for ( std::size_t i = 0; i < folders; ++i )
+                std::filesystem::create_directories(
+                    unit.workdir / std::format( "folder-with-a-long-name-{:02}", i ) );
+
+        hub_to_unit req           = hub_to_unit_init_default;
+        req.which_sub             = hub_to_unit_list_folder_tag;
+        req.sub.list_folder.limit = folders;
+        // each reply lists all folders in about 700 bytes, the replies of `small` take twice the
+        // receive buffer the hub used to have and those of `large` exceed max_unit_message
+        std::vector< hub_to_unit > small( 12, req );
+        std::vector< hub_to_unit > large( 40, req );
+        std::vector< unit_to_hub > resps( large.size() );
+
+        std::vector< uint8_t > buffer( 1024 * 256 );
+        circular_buffer_memory mem{ std::span{ buffer } };
+        uint8_t                hub_mem[1024 * 16];
+        task_ctx               hub{ ctx.loop, ctx, std::span{ hub_mem } };
+        bool                   done     = false;
+        bool                   small_ok = false;
+        bool                   large_ok = true;
+        std::size_t            listed   = 0;
+        std::size_t            first    = 0;
+
+        auto count = []( unit_to_hub const& r ) {
+                std::size_t n = 0;
+                if ( r.which_sub == unit_to_hub_list_folder_tag )
+                        for ( npb_str* e = r.sub.list_folder.entries; e; e = e->next )
+                                ++n;
+                return n;
+        };
+        auto hub_coro = [&]( task_ctx& hub ) -> ecor::task< void > {
+                auto  e = co_await server.new_event();
+                auto& c = e.client;
+
+                small_ok = co_await transact_batch( hub, c, mem, small, resps );
+                for ( std::size_t i = 0; i < small.size(); ++i )
+                        listed += count( resps[i] ) == folders;
+
+                // replies past max_unit_message fail, the reply arrives instead of timing out
+                large_ok = co_await transact_batch( hub, c, mem, large, resps );
+                first    = count( resps[0] );
+                done     = true;
+        };
+        auto h = hub_coro( hub ).connect( ecor::_dummy_receiver{} );
+        h.start();
+
+        ASSERT_EQ( server_init( server, ctx.loop, 0 ), 0 );
+        unit.connect( server );
+        run_until( ctx.loop, done );
+
+        EXPECT_TRUE( done );
+        EXPECT_TRUE( small_ok );
+        EXPECT_EQ( listed, small.size() );
+        EXPECT_FALSE( large_ok );
+        EXPECT_EQ( first, folders );
+
+        unit.stop( server );
+        uv_close( (uv_handle_t*) &server.tcp, nullptr );
+        run_loop( ctx.loop, 20 );
+}
+
+
+// Number of clients of each shard, queried in the threads of the shards
+std::vector< std::size_t > shard_client_counts( server_shards& shards )
+{
+        std::vector< std::promise< std::size_t > > counts( shards.size() );
+        for ( std::size_t i = 0; i < shards.size(); ++i )
+                shards.post( i, [&c = counts[i]]( server& s ) {
+                        c.set_value( s.client_count() );
+                } );
+        std::vector< std::size_t > res;
+        for ( auto& c : counts )
+                res.push_back( c.get_future().get() );
+        return res;
+}
+
+std::size_t total( std::vector< std::size_t > const& counts )
+{
+        return std::accumulate( counts.begin(), counts.end(), std::size_t{ 0 } );
+}
+
+// Number of shards with at least one client
+std::size_t used( std::vector< std::size_t > const& counts )
+{
+        return (std::size_t) std::ranges::count_if( counts, []( std::size_t c ) {
+                return c > 0;
+        } );
+}
+
+TEST( server, sharded )
+{
+        static constexpr std::size_t shards_n = 4;
+        // the kernel spreads connections by their addresses, they are added a window at a time
+        // until a second shard got some
+        static constexpr std::size_t max_n = raw_fleet::window * 4;
+
+        auto const main_thread = std::this_thread::get_id();
+
+        server_shards shards;
+        ASSERT_EQ( server_init( shards, 0, shards_n ), 0 );
+        EXPECT_EQ( shards.size(), shards_n );
+
+        uv_loop_t* loop = uv_default_loop();
+        raw_fleet  fleet{ .loop = loop, .n = max_n };
+        uv_ip4_addr( "127.0.0.1", shards.port(), &fleet.dest );
+        // raised by a window per round, the connections were allocated for all rounds
+        fleet.n = 0;
+
+        auto           counts = shard_client_counts( shards );
+        uint64_t const start  = uv_hrtime();
+        while ( used( counts ) < 2 && fleet.n < max_n ) {
+                fleet.n += raw_fleet::window;
+                for ( std::size_t i = 0; i < raw_fleet::window; ++i )
+                        fleet.connect_next();
+                while ( total( counts ) < fleet.n && uv_hrtime() - start < 10'000'000'000 ) {
+                        uv_run( loop, UV_RUN_NOWAIT );
+                        counts = shard_client_counts( shards );
+                }
+                EXPECT_EQ( total( counts ), fleet.n );
+                if ( total( counts ) != fleet.n )
+                        break;
+        }
+        EXPECT_GT( used( counts ), 1u );
+        for ( std::size_t i = 0; i < shards_n; ++i )
+                spdlog::info( "Shard {} has {} clients", i, counts[i] );
+
+        for ( std::size_t i = 0; i < shards_n; ++i )
+                shards.post( i, [i]( server& s ) {
+                        bool first = true;
+                        s.for_each_client( [&]( server_client& c ) {
+                                if ( std::exchange( first, false ) )
+                                        s.bind_mac( c, std::format( "unit-{}", i ) );
+                        } );
+                } );
+        // functions posted to a shard run in order, this waits for the binding
+        shard_client_counts( shards );
+
+        for ( std::size_t i = 0; i < shards_n; ++i ) {
+                auto mac = std::format( "unit-{}", i );
+                if ( counts[i] == 0 ) {
+                        EXPECT_FALSE( shards.with_unit( mac, []( server_client* ) {} ) );
+                        continue;
+                }
+                std::promise< bool > found;
+                EXPECT_TRUE( shards.with_unit( mac, [&]( server_client* c ) {
+                        found.set_value(
+                            c && c->server.shard_id == i &&
+                            std::this_thread::get_id() != main_thread );
+                } ) );
+                EXPECT_TRUE( found.get_future().get() ) << mac;
+        }
+
+        fleet.close_all();
+        while ( total( counts ) > 0 && uv_hrtime() - start < 20'000'000'000 ) {
+                uv_run( loop, UV_RUN_NOWAIT );
+                counts = shard_client_counts( shards );
+        }
+        EXPECT_EQ( total( counts ), 0u );
+        EXPECT_FALSE( shards.with_unit( "unit-0", []( server_client* ) {} ) );
+        run_loop( loop, 20 );
+}
+
+
 }  // namespace trctl
\ No newline at end of file
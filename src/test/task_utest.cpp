@@ -0,0 +1,189 @@
+#include "../task.hpp"
+#include "../util/async_storage.hpp"
+#include "./tutil.hpp"
+
+#include <gtest/gtest.h>
+
+namespace trctl
+{
+
+struct sleep_obj
+{
+        int* destroyed;
+
+        sleep_obj( async_ptr_source< sleep_obj >, int* d )
+          : destroyed( d )
+        {
+        }
+};
+task< void > destroy( auto&, sleep_obj& x )
+{
+        ++*x.destroyed;
+        co_return;
+}
+
+// Keeps the loop alive with a far away timer, so uv_backend_timeout() reports whenever the next
+// iteration would block in poll (> 0) or spin (== 0).
+struct far_timer
+{
+        uv_timer_t timer;
+
+        far_timer( uv_loop_t* loop )
+        {
+                uv_timer_init( loop, &timer );
+                uv_timer_start( &timer, +[]( uv_timer_t* ) {}, 10'000, 0 );
+        }
+
+        ~far_timer()
+        {
+                uv_close( (uv_handle_t*) &timer, nullptr );
+                uv_run( timer.loop, UV_RUN_NOWAIT );
+        }
+};
+
+TEST( task, idle_loop_sleeps )
+{
+        test_ctx  ctx;
+        far_timer t{ ctx.loop };
+        uint8_t   membuf[1024];
+
+        async_map< int, sleep_obj > m( ctx.loop, ctx, std::span< uint8_t >( membuf ) );
+        run_loop( ctx.loop, 10 );
+
+        EXPECT_FALSE( ctx.is_armed() );
+        EXPECT_GT( uv_backend_timeout( ctx.loop ), 0 );
+}
+
+TEST( task, component_ticks_on_demand )
+{
+        test_ctx  ctx;
+        far_timer t{ ctx.loop };
+        uint8_t   membuf[1024];
+        int       destroyed = 0;
+
+        async_map< int, sleep_obj > m( ctx.loop, ctx, std::span< uint8_t >( membuf ) );
+        {
+                auto p = m.emplace( m.end(), 1, &destroyed );
+                ASSERT_TRUE( p );
+                m.erase( m.find( 1 ) );
+        }
+        // dropped pointer has to wake up the map
+        EXPECT_EQ( uv_backend_timeout( ctx.loop ), 0 );
+
+        for ( std::size_t i = 0; i < 10; ++i )
+                uv_run( ctx.loop, UV_RUN_NOWAIT );
+
+        EXPECT_EQ( destroyed, 1 );
+        EXPECT_FALSE( ctx.is_armed() );
+        EXPECT_GT( uv_backend_timeout( ctx.loop ), 0 );
+}
+
+task< void > await_shutdown( test_ctx&, async_map< int, sleep_obj >& m, bool& done )
+{
+        co_await m.shutdown();
+        done = true;
+}
+
+TEST( task, shutdown_waits_for_destructions )
+{
+        test_ctx  ctx;
+        far_timer t{ ctx.loop };
+        uint8_t   membuf[1024];
+        int       destroyed = 0;
+        bool      done      = false;
+
+        async_map< int, sleep_obj > m( ctx.loop, ctx, std::span< uint8_t >( membuf ) );
+        // ticks without a pending shutdown are not mistaken for its completion
+        run_loop( ctx.loop, 10 );
+
+        m.emplace( m.end(), 1, &destroyed );
+        m.emplace( m.end(), 2, &destroyed );
+        auto op = await_shutdown( ctx, m, done ).connect( ecor::_dummy_receiver{} );
+        op.start();
+        EXPECT_FALSE( done );
+
+        for ( std::size_t i = 0; i < 20 && !done; ++i )
+                uv_run( ctx.loop, UV_RUN_NOWAIT );
+        EXPECT_TRUE( done );
+        EXPECT_EQ( destroyed, 2 );
+        EXPECT_FALSE( ctx.is_armed() );
+}
+
+// Component that resumes waiting tasks from its tick
+struct ticker : comp_buff, component
+{
+        ecor::broadcast_source< ecor::set_value_t() > ticked;
+
+        ticker( uv_loop_t* loop, task_core& core )
+          : component( loop, core, comp_buff::buffer )
+        {
+        }
+
+        void tick() override
+        {
+                ticked.set_value();
+        }
+
+        task< void > shutdown() override
+        {
+                co_return;
+        }
+};
+
+task< void > await_tick( test_ctx&, ticker& t, bool& done )
+{
+        co_await t.ticked.schedule();
+        done = true;
+}
+
+TEST( task, rescheduled_during_tick )
+{
+        test_ctx  ctx;
+        far_timer t{ ctx.loop };
+        ticker    tk{ ctx.loop, ctx };
+        bool      done = false;
+
+        auto op = await_tick( ctx, tk, done ).connect( ecor::_dummy_receiver{} );
+        op.start();
+        run_loop( ctx.loop, 10 );
+        EXPECT_FALSE( done );
+        EXPECT_FALSE( ctx.is_armed() );
+
+        // the task resumed by the tick is queued on the core from within the idle phase
+        tk.schedule_tick();
+        for ( std::size_t i = 0; i < 10 && !done; ++i )
+                uv_run( ctx.loop, UV_RUN_NOWAIT );
+        EXPECT_TRUE( done );
+
+        run_loop( ctx.loop, 10 );
+        EXPECT_FALSE( ctx.is_armed() );
+        EXPECT_GT( uv_backend_timeout( ctx.loop ), 0 );
+}
+
+task< void > return_now( task_ctx& )
+{
+        co_return;
+}
+
+TEST( task, slots_reuse_memory )
+{
+        test_ctx                 ctx;
+        task_slots< 1024, 1024 > slots{ ctx.loop, ctx };
+        slots.max_spare = 1;
+        auto f          = []( task_ctx& c, std::span< uint8_t > ) {
+                return return_now( c );
+        };
+
+        ASSERT_TRUE( slots.emplace_slot( ctx.loop, f ) );
+        ASSERT_TRUE( slots.emplace_slot( ctx.loop, f ) );
+        run_loop( ctx.loop, 10 );
+        // the second finished slot went back to the heap
+        EXPECT_EQ( slots.spare_count(), 1u );
+
+        ASSERT_TRUE( slots.emplace_slot( ctx.loop, f ) );
+        EXPECT_EQ( slots.spare_count(), 0u );
+        run_loop( ctx.loop, 10 );
+        EXPECT_EQ( slots.spare_count(), 1u );
+}
+
+}  // namespace trctl
@@ -1,12 +1,17 @@
 #pragma once
 
 #include "../fs.hpp"
+#include "../iface.hpp"
 #include "../util/async_sender_fifo.hpp"
 #include "../util/async_storage.hpp"
+#include "../util/range_set.hpp"
 #include "./folder.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <filesystem>
+#include <span>
 
 namespace trctl
 {
@@ -14,12 +19,29 @@ namespace trctl
 
 struct file_transfer_slot : folder_dep, comp_buff, task_ctx
 {
+        // upper bound of data requests the hub can keep in flight
+        static constexpr uint32_t max_window = max_transfer_window;
+        // upper bound of fs_write requests issued concurrently to the threadpool
+        static constexpr std::size_t max_writes = 4;
+
         async_ptr_source< file_transfer_slot > src;
         async_sender_fifo                      workers;
+        async_sender_fifo                      writers{ max_writes };
         uv_file                                fh;
         uint64_t                               filesize;
-        uint64_t                               written_bytes = 0;
         std::string                            path;
+        uint32_t                               window      = 1;
+        bool                                   preallocate = true;
+        // written data, claim() keeps room for one more range per chunk in flight
+        range_set< 4 * max_window > received;
+        // claimed chunks that were not yet written and hashed, disjoint from each other and from
+        // `received`, the first `writes_active` are valid
+        std::array< range_set< 1 >::range, max_window > writing{};
+        uint32_t                                        writes_active = 0;
+        // hash of [0, hashed), advanced as written data becomes contiguous
+        fnv1a    hasher;
+        uint64_t hashed  = 0;
+        bool     hashing = false;
 
         file_transfer_slot(
             async_ptr_source< file_transfer_slot > src,
@@ -43,31 +65,136 @@ struct file_transfer_slot : folder_dep, comp_buff, task_ctx
                 this->fh =
                     co_await fs_open{ loop, this->path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR };
                 spdlog::info( "Opened file (fh={})", this->fh );
+                // reserving the whole file up front avoids fragmentation and per chunk metadata
+                // updates of extending writes, and reports lack of space before any data is sent
+                if ( preallocate && filesize != 0 )
+                        co_await fs_allocate{ loop, fh, filesize };
+        }
+
+        /// Reserves `[offset, offset + size)` for a write, rejects chunks overlapping data that was
+        /// written or is being written and chunks outside of the granted window. Each successful
+        /// claim has to be followed by `write_done()`, which releases it whatever the outcome of
+        /// the write was, so a failed chunk can be sent again.
+        [[nodiscard]] bool claim( uint64_t offset, uint64_t size )
+        {
+                // the hub keeps at most `window` chunks in flight, all ending within `window`
+                // chunks from the acknowledged offset
+                uint64_t const limit = received.contiguous() + window * max_transfer_chunk;
+                if ( size > max_transfer_chunk || writes_active >= window ||
+                     offset + size > limit ) {
+                        spdlog::error(
+                            "Chunk {}+{} outside of window {}, {} in flight, acked: {}",
+                            offset,
+                            size,
+                            window,
+                            writes_active,
+                            received.contiguous() );
+                        return false;
+                }
+                auto active = std::span{ writing }.first( writes_active );
+                if ( received.overlaps( offset, offset + size ) ||
+                     std::ranges::any_of( active, [&]( auto const& r ) {
+                             return r.begin < offset + size && offset < r.end;
+                     } ) ) {
+                        spdlog::error( "Chunk {}+{} overlaps already received data", offset, size );
+                        return false;
+                }
+                if ( received.size() + writes_active >= 4 * max_window ) {
+                        spdlog::error(
+                            "Too many out of order chunks, window: {}, acked: {}",
+                            window,
+                            received.contiguous() );
+                        return false;
+                }
+                writing[writes_active++] = { offset, offset + size };
+                return true;
         }
 
+        void write_done( uint64_t offset )
+        {
+                auto active = std::span{ writing }.first( writes_active );
+                *std::ranges::find( active, offset, &range_set< 1 >::range::begin ) = active.back();
+                if ( --writes_active == 0 )
+                        _idle.set_value();
+        }
+
+        /// Writes a claimed chunk, may run concurrently with writes of other claimed chunks
         task< void > write( uint64_t offset, std::span< uint8_t const > data )
         {
                 spdlog::info(
                     "Writing {} bytes at offset {} to file (fh={})", data.size(), offset, fh );
                 co_await fs_write{ loop, fh, offset, data };
-                written_bytes += data.size();
+                if ( !received.insert( offset, offset + data.size() ) ) {
+                        spdlog::error(
+                            "Too many written ranges, acked: {}", received.contiguous() );
+                        co_yield ecor::with_error{ error::input_error };
+                }
+                co_await advance_hash( offset, data );
         }
 
+        /// Hashes the chunk that was just written if it continues the hashed prefix, and reads
+        /// back chunks written out of order that became contiguous with it. Only one read back
+        /// runs at a time, it also picks up chunks written while it waits for the file.
+        task< void > advance_hash( uint64_t offset, std::span< uint8_t const > data )
+        {
+                if ( hashing )
+                        co_return;
+                if ( offset <= hashed && hashed < offset + data.size() ) {
+                        hasher( data.subspan( hashed - offset ) );
+                        hashed = offset + data.size();
+                }
+                hashing  = true;
+                auto err = co_await ( read_back() | ecor::sink_err );
+                hashing  = false;
+                if ( err )
+                        co_yield ecor::with_error{ error::libuv_error };
+        }
+
+        task< void > read_back()
+        {
+                while ( hashed < received.contiguous() ) {
+                        auto n = std::min< uint64_t >(
+                            std::size( buffer ), received.contiguous() - hashed );
+                        std::span d = co_await fs_read{
+                            loop, fh, hashed, std::span{ buffer }.subspan( 0, n ) };
+                        if ( d.empty() ) {
+                                spdlog::error( "Unexpected end of file at offset {}", hashed );
+                                co_yield ecor::with_error{ error::libuv_error };
+                        }
+                        hasher( d );
+                        hashed += d.size();
+                }
+        }
+
+        /// Fills the cumulative acknowledgement of written data
+        void ack( file_resp& resp ) const
+        {
+                resp.window = window;
+                resp.acked  = received.contiguous();
+                received.gaps( [&]( uint64_t b, uint64_t e ) {
+                        if ( resp.gaps_count == std::size( resp.gaps ) )
+                                return;
+                        resp.gaps[resp.gaps_count++] = file_range{ .offset = b, .size = e - b };
+                } );
+        }
+
+        // read back of chunks written out of order
         uint8_t buffer[4 * 1024];
 
         task< void > end( uint32_t expected_hash )
         {
                 spdlog::info( "Finalizing transfer for file (fh={})", fh );
-                if ( written_bytes != filesize ) {
-                        spdlog::error( "Got invalid written size: {}/{}", written_bytes, filesize );
+                while ( writes_active != 0 )
+                        co_await _idle.schedule();
+                if ( !received.covers( filesize ) ) {
+                        spdlog::error(
+                            "Incomplete file: {} of {} bytes contiguous, {} ranges written",
+                            received.contiguous(),
+                            filesize,
+                            received.size() );
                         co_yield ecor::with_error{ error::input_error };
                 }
 
-                fnv1a hasher;
-                for ( uint32_t offset = 0; offset < filesize; offset += std::size( buffer ) ) {
-                        std::span data = co_await fs_read{ loop, fh, offset, buffer };
-                        hasher( data );
-                }
                 if ( hasher.hash != expected_hash ) {
                         spdlog::error(
                             "Hash mismatch: expected {:08x}, got {:08x}",
@@ -103,12 +230,17 @@ struct file_transfer_slot : folder_dep, comp_buff, task_ctx
                 }
                 co_return;
         };
+
+private:
+        ecor::broadcast_source< ecor::set_value_t() > _idle;
 };
 
 
 struct file_transfer_ctx : comp_buff, component
 {
         std::filesystem::path& workdir;
+        // reserve space of transferred files at start
+        bool preallocate = true;
 
         file_transfer_ctx( uv_loop_t* l, task_core& c, std::filesystem::path& wd )
           : component( l, c, comp_buff::buffer )
@@ -139,6 +271,7 @@ task< void > start_transfer(
     uint32_t                    id,
     std::string_view            filename,
     uint64_t                    filesize,
+    uint32_t                    window,
     zll::ll_list< folder_dep >& deps )
 {
         auto iter = ctx.transfers.find( id );
@@ -149,7 +282,14 @@ task< void > start_transfer(
 
         auto slot =
             ctx.transfers.emplace( iter, id, tctx.loop, tctx.core, filesize, filename, deps );
-        co_await ( slot->start() | slot->workers.wrap() );
+        slot->window      = std::clamp< uint32_t >( window, 1, file_transfer_slot::max_window );
+        slot->preallocate = ctx.preallocate;
+        auto opt_err = co_await ( slot->start() | slot->workers.wrap() | ecor::sink_err );
+        if ( opt_err ) {
+                // destroy() closes and unlinks the partially created file
+                ctx.transfers.erase( ctx.transfers.find( id ) );
+                co_yield ecor::with_error{ unify( *opt_err ) };
+        }
 }
 
 task< void > transfer_data(
@@ -173,13 +313,25 @@ task< void > transfer_data(
                     t->filesize );
                 co_yield ecor::with_error{ error::input_error };
         }
-        co_await ( t->write( offset, data ) | t->workers.wrap() );
+        if ( !t->claim( offset, data.size() ) )
+                co_yield ecor::with_error{ error::input_error };
+        // end() waits for all claimed writes, so the slot outlives this write
+        auto err = co_await ( t->write( offset, data ) | t->writers.wrap() | ecor::sink_err );
+        t->write_done( offset );
+        if ( err )
+                co_yield ecor::with_error{ unify( *err ) };
 }
 
+/// Fills acknowledgement of transfer `id` into `resp`, does nothing if there is no such transfer
+inline void transfer_ack( file_transfer_ctx& ctx, uint32_t id, file_resp& resp )
+{
+        auto it = ctx.transfers.find( id );
+        if ( it != ctx.transfers.end() )
+                it->second->ack( resp );
+}
 
 task< error > end_transfer( auto&, file_transfer_ctx& ctx, uint32_t id, uint32_t expected_hash )
 {
-        // XXX: this should wait for active reads/writes to finish
         auto it = ctx.transfers.find( id );
         if ( it == ctx.transfers.end() ) {
                 spdlog::error( "No active transfer with ID {}", id );
@@ -11,6 +11,9 @@ int main( int argc, char** argv )
         int                   port;
         std::string           address;
         std::filesystem::path workdir;
+        std::size_t           output_mem;
+        std::size_t           max_tasks;
+        uint64_t              kill_grace;
         CLI::App              app{ "trctl" };
 
         app.add_option( "-p,--port", port, "Port to listen on" )->default_val( "7000" );
@@ -19,6 +22,12 @@ int main( int argc, char** argv )
         app.add_option( "-w,--workdir", workdir, "Client working directory" )
             ->default_val( "./_work" )
             ->check( CLI::ExistingDirectory );
+        app.add_option( "--output-mem", output_mem, "Task output bytes held in memory" )
+            ->default_val( "262144" );
+        app.add_option( "--max-tasks", max_tasks, "Tasks running at once, 0 for no limit" )
+            ->default_val( "0" );
+        app.add_option( "--kill-grace", kill_grace, "SIGTERM to SIGKILL delay on cancel, ms" )
+            ->default_val( "5000" );
 
         CLI11_PARSE( app, argc, argv );
 
@@ -26,6 +35,9 @@ int main( int argc, char** argv )
 
         trctl::task_core tcore{ loop };
         trctl::unit_ctx  uctx{ loop, workdir, tcore };
+        uctx.pctx.output_mem_limit = output_mem;
+        uctx.pctx.max_running      = max_tasks;
+        uctx.pctx.killer.grace_ms  = kill_grace;
 
         uint8_t         buffer[1024 * 1024] = {};
         trctl::task_ctx tctx{ loop, tcore, std::span{ buffer } };
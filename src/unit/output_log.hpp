@@ -0,0 +1,324 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <uv.h>
+#include <vector>
+
+namespace trctl
+{
+
+/// Append-only file holding the stdout and stderr of a task as written. An index of runs of
+/// each stream maps offsets within the stream to offsets in the file. Appends are copied and
+/// written in order with uv_fs_write, only the part of the file written so far can be read.
+struct output_log
+{
+        // bytes of one stream stored contiguously in the file
+        struct run
+        {
+                uint64_t stream_offset;
+                uint64_t file_offset;
+                uint64_t size;
+        };
+
+        /// Gets the data read back, malloc'd, and how many bytes of it were read. The data is null
+        /// if the read failed.
+        using read_cb = std::function< void( uint8_t*, std::size_t ) >;
+
+        // called once more of the file was written
+        std::function< void() > on_written;
+
+        output_log() = default;
+
+        output_log( output_log const& )            = delete;
+        output_log& operator=( output_log const& ) = delete;
+        output_log( output_log&& )                 = delete;
+        output_log& operator=( output_log&& )      = delete;
+
+        ~output_log()
+        {
+                close();
+        }
+
+        /// Creates the file at `p`, an existing one is truncated. Only the creation blocks.
+        bool open( uv_loop_t* loop, std::string p )
+        {
+                close();
+                int fd = ::open( p.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+                if ( fd < 0 ) {
+                        spdlog::error( "Failed to open output log {}: {}", p, strerror( errno ) );
+                        return false;
+                }
+                _f        = std::make_shared< _file >();
+                _f->loop  = loop;
+                _f->fd    = fd;
+                _f->path  = std::move( p );
+                _f->owner = this;
+                _size     = 0;
+                for ( auto& r : _runs )
+                        r.clear();
+                return true;
+        }
+
+        bool is_open() const
+        {
+                return _f != nullptr;
+        }
+
+        /// Appends are taken, the log is open and no write failed
+        bool writable() const
+        {
+                return _f && !_f->failed;
+        }
+
+        uv_file handle() const
+        {
+                return _f ? _f->fd : -1;
+        }
+
+        uint64_t size() const
+        {
+                return _size;
+        }
+
+        /// Bytes at the start of the file that were written
+        uint64_t written() const
+        {
+                return _f ? _f->written : 0;
+        }
+
+        /// Bytes of appends waiting for their write
+        std::size_t pending() const
+        {
+                return _f ? _f->pending : 0;
+        }
+
+        /// Bytes of the stream stored so far
+        uint64_t stream_size( bool is_err ) const
+        {
+                auto& runs = _runs[is_err];
+                return runs.empty() ? 0 : runs.back().stream_offset + runs.back().size;
+        }
+
+        /// Written part of the file holding the stream from `offset` on: its offset in the file
+        /// and how many bytes of the stream are stored there contiguously
+        std::optional< std::pair< uint64_t, uint64_t > >
+        locate( bool is_err, uint64_t offset ) const
+        {
+                auto& runs = _runs[is_err];
+                auto  it   = std::upper_bound(
+                    runs.begin(), runs.end(), offset, []( uint64_t o, run const& r ) {
+                            return o < r.stream_offset;
+                    } );
+                if ( it == runs.begin() )
+                        return std::nullopt;
+                --it;
+                uint64_t const skip = offset - it->stream_offset;
+                uint64_t const at   = it->file_offset + skip;
+                if ( skip >= it->size || at >= written() )
+                        return std::nullopt;
+                return std::pair{ at, std::min( it->size - skip, written() - at ) };
+        }
+
+        /// Appends output of the stream, returns its offset in the file. The data is copied and
+        /// written in the background.
+        std::optional< uint64_t > append( bool is_err, std::span< uint8_t const > data )
+        {
+                if ( !_f || _f->failed )
+                        return std::nullopt;
+                std::unique_ptr< uint8_t[] > copy{ new ( std::nothrow ) uint8_t[data.size()] };
+                if ( !copy ) {
+                        spdlog::error( "Failed to queue {} bytes for output log", data.size() );
+                        return std::nullopt;
+                }
+                std::memcpy( copy.get(), data.data(), data.size() );
+                _f->queue.push_back( { std::move( copy ), data.size() } );
+                _f->pending += data.size();
+                write_next( _f );
+
+                uint64_t const offset = _size;
+                _size += data.size();
+                auto& runs = _runs[is_err];
+                if ( !runs.empty() && runs.back().file_offset + runs.back().size == offset )
+                        runs.back().size += data.size();
+                else
+                        runs.push_back( { stream_size( is_err ), offset, data.size() } );
+                return offset;
+        }
+
+        /// Reads `n` bytes at `offset` of the file, which have to be written already. `done` is
+        /// not called once the log is closed.
+        bool read_back( uint64_t offset, std::size_t n, read_cb done )
+        {
+                if ( !_f || offset + n > _f->written )
+                        return false;
+                auto* mem = (uint8_t*) malloc( std::max< std::size_t >( n, 1 ) );
+                if ( !mem )
+                        return false;
+                auto* req = new _read_req{ .f = _f, .mem = mem, .done = std::move( done ) };
+                req->fs.data = req;
+                uv_buf_t buf = uv_buf_init( (char*) mem, n );
+                int      e   = uv_fs_read(
+                    _f->loop, &req->fs, _f->fd, &buf, 1, (int64_t) offset, +[]( uv_fs_t* fs ) {
+                            std::unique_ptr< _read_req > req{ (_read_req*) fs->data };
+                            ssize_t const                res = fs->result;
+                            uv_fs_req_cleanup( fs );
+                            if ( !req->f->owner ) {
+                                    free( req->mem );
+                                    return;
+                            }
+                            if ( res < 0 ) {
+                                    spdlog::error(
+                                        "Failed to read output log {}: {}",
+                                        req->f->path,
+                                        uv_strerror( res ) );
+                                    free( req->mem );
+                                    req->done( nullptr, 0 );
+                                    return;
+                            }
+                            req->done( req->mem, (std::size_t) res );
+                    } );
+                if ( e < 0 ) {
+                        spdlog::error(
+                            "Failed to read output log {}: {}", _f->path, uv_strerror( e ) );
+                        free( mem );
+                        delete req;
+                        return false;
+                }
+                return true;
+        }
+
+        /// Removes the file, it is closed once its pending requests finished
+        void close()
+        {
+                if ( !_f )
+                        return;
+                _f->owner = nullptr;
+                _f->queue.clear();
+                _f->pending = 0;
+                auto* req   = new uv_fs_t;
+                if ( uv_fs_unlink( _f->loop, req, _f->path.c_str(), on_done ) < 0 )
+                        delete req;
+                _f.reset();
+        }
+
+private:
+        // data of an append waiting for its write
+        struct _chunk
+        {
+                std::unique_ptr< uint8_t[] > data;
+                std::size_t                  size;
+        };
+
+        // the open file, kept alive by the requests in flight
+        struct _file
+        {
+                uv_loop_t*           loop  = nullptr;
+                uv_file              fd    = -1;
+                std::string          path;
+                output_log*          owner = nullptr;
+                std::deque< _chunk > queue;
+                // bytes of the front chunk written already
+                std::size_t front_done = 0;
+                std::size_t pending    = 0;
+                uint64_t    written    = 0;
+                bool        writing    = false;
+                bool        failed     = false;
+                uv_fs_t     write_fs;
+
+                ~_file()
+                {
+                        auto* req = new uv_fs_t;
+                        if ( uv_fs_close( loop, req, fd, on_done ) < 0 )
+                                delete req;
+                }
+        };
+
+        struct _read_req
+        {
+                uv_fs_t                  fs;
+                std::shared_ptr< _file > f;
+                uint8_t*                 mem;
+                read_cb                  done;
+        };
+
+        static void on_done( uv_fs_t* req )
+        {
+                uv_fs_req_cleanup( req );
+                delete req;
+        }
+
+        /// Writes the next queued chunk unless a write is in flight, the request keeps the file
+        /// alive until it finished
+        static void write_next( std::shared_ptr< _file > const& f )
+        {
+                if ( f->writing || f->failed || f->queue.empty() )
+                        return;
+                auto& c = f->queue.front();
+                // released in the callback
+                f->write_fs.data = new std::shared_ptr< _file >( f );
+                uv_buf_t buf =
+                    uv_buf_init( (char*) c.data.get() + f->front_done, c.size - f->front_done );
+                int e = uv_fs_write(
+                    f->loop, &f->write_fs, f->fd, &buf, 1, (int64_t) f->written, on_written_cb );
+                if ( e < 0 ) {
+                        delete (std::shared_ptr< _file >*) f->write_fs.data;
+                        fail( *f, e );
+                        return;
+                }
+                f->writing = true;
+        }
+
+        static void on_written_cb( uv_fs_t* fs )
+        {
+                std::unique_ptr< std::shared_ptr< _file > > self{
+                    (std::shared_ptr< _file >*) fs->data };
+                auto&         f   = **self;
+                ssize_t const res = fs->result;
+                uv_fs_req_cleanup( fs );
+                f.writing = false;
+                if ( res <= 0 ) {
+                        fail( f, res < 0 ? (int) res : UV_EIO );
+                } else if ( !f.queue.empty() ) {
+                        // the queue is cleared once the log is closed
+                        f.written += (uint64_t) res;
+                        f.pending -= (std::size_t) res;
+                        f.front_done += (std::size_t) res;
+                        if ( f.front_done == f.queue.front().size ) {
+                                f.queue.pop_front();
+                                f.front_done = 0;
+                        }
+                        write_next( *self );
+                }
+                if ( f.owner && f.owner->on_written )
+                        f.owner->on_written();
+        }
+
+        /// Drops the queued appends, the data past the written part is lost
+        static void fail( _file& f, int e )
+        {
+                spdlog::error( "Failed to append to output log {}: {}", f.path, uv_strerror( e ) );
+                f.failed = true;
+                f.queue.clear();
+                f.pending = 0;
+        }
+
+        std::shared_ptr< _file > _f;
+        uint64_t                 _size = 0;
+        std::vector< run >       _runs[2];
+};
+
+}  // namespace trctl
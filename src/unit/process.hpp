@@ -1,32 +1,78 @@
 #pragma once
 
 #include "../npb_extra.h"
+#include "../fs.hpp"
 #include "../task.hpp"
 #include "../util.hpp"
 #include "../util/async_optional.hpp"
 #include "../util/async_queue.hpp"
 #include "../util/async_storage.hpp"
+#include "../util/buffer_pool.hpp"
+#include "output_log.hpp"
+#include "usage.hpp"
 
+#include <charconv>
+#include <cmath>
 #include <deque>
+#include <format>
+#include <functional>
+#include <limits>
+#include <list>
+#include <map>
+#include <optional>
+#include <random>
 #include <ranges>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
 
 namespace trctl
 {
+/// Output buffer, owned by `pool` if set and malloc'd otherwise
 struct mem_buff
 {
-        uint8_t* mem;
-        size_t   size;
+        uint8_t*     mem;
+        size_t       size;
+        size_t       cap  = 0;
+        buffer_pool* pool = nullptr;
 
         mem_buff( uint8_t* m, size_t s )
           : mem( m )
           , size( s )
+          , cap( s )
+        {
+        }
+
+        /// Takes `m` of capacity `c` acquired from `p`, `s` bytes of it are used
+        mem_buff( buffer_pool& p, uint8_t* m, size_t s, size_t c )
+          : mem( m )
+          , size( s )
+          , cap( c )
+          , pool( &p )
         {
         }
 
         ~mem_buff()
         {
-                if ( mem )
-                        free( mem );
+                reset();
+        }
+
+        /// Appends content of `other`, false if the memory could not grow
+        bool append( mem_buff const& other )
+        {
+                if ( size + other.size > cap && !regrow( size + other.size ) )
+                        return false;
+                std::memcpy( mem + size, other.mem, other.size );
+                size += other.size;
+                return true;
+        }
+
+        /// Moves the content to the smallest pooled buffer that holds it
+        void fit()
+        {
+                if ( pool && buffer_pool::capacity_for( size ) < cap )
+                        regrow( size );
         }
 
         mem_buff( mem_buff const& )            = delete;
@@ -34,23 +80,76 @@ struct mem_buff
         mem_buff( mem_buff&& other ) noexcept
           : mem( other.mem )
           , size( other.size )
+          , cap( other.cap )
+          , pool( other.pool )
         {
                 other.mem  = nullptr;
                 other.size = 0;
+                other.cap  = 0;
+        }
+        mem_buff& operator=( mem_buff&& other ) noexcept
+        {
+                if ( this != &other ) {
+                        reset();
+                        mem  = std::exchange( other.mem, nullptr );
+                        size = std::exchange( other.size, 0 );
+                        cap  = std::exchange( other.cap, 0 );
+                        pool = other.pool;
+                }
+                return *this;
+        }
+
+private:
+        bool regrow( size_t n )
+        {
+                if ( !pool ) {
+                        auto* m = (uint8_t*) realloc( mem, n );
+                        if ( !m )
+                                return false;
+                        mem = m;
+                        cap = n;
+                        return true;
+                }
+                auto* m = pool->acquire( n );
+                if ( !m )
+                        return false;
+                std::memcpy( m, mem, size );
+                pool->release( mem, cap );
+                mem = m;
+                cap = buffer_pool::capacity_for( n );
+                return true;
+        }
+
+        void reset()
+        {
+                if ( !mem )
+                        return;
+                if ( pool )
+                        pool->release( mem, cap );
+                else
+                        free( mem );
+                mem = nullptr;
         }
 };
 
+/// Copy of `b` in `mem`, its data is null if the allocation failed
 inline npb_data copy( circular_buffer_memory& mem, mem_buff& b )
 {
-        npb_data d;
-        d.data = (uint8_t*) mem.allocate( b.size, 1 );
-        std::memcpy( d.data, b.mem, b.size );
-        d.size = b.size;
-        return d;
+        auto* p = (uint8_t*) mem.allocate( b.size, 1 );
+        if ( !p )
+                return { .data = nullptr, .size = 0 };
+        std::memcpy( p, b.mem, b.size );
+        return { .data = p, .size = (uint32_t) b.size };
 }
 
+/// Events of one task. All output is appended to the log of the task, where it can be read by
+/// offset once written. Queued output is held in memory up to `mem_limit` bytes, output beyond
+/// that is read back from the log in chunks ahead of its dequeue. Without a log the producer is
+/// expected to pause while the stream is full().
 struct proc_stream
 {
+        // read back from the log at once
+        static constexpr std::size_t spill_chunk = 4 * 1024;
 
         struct stdout_evt
         {
@@ -67,21 +166,49 @@ struct proc_stream
                 int64_t exit_status;
         };
 
-        using evt_var     = std::variant< stdout_evt, stderr_evt, exit_evt >;
+        // stands in the queue for all spilled output, never dequeued by consumers
+        struct spill_evt
+        {
+        };
+
+        using evt_var     = std::variant< stdout_evt, stderr_evt, exit_evt, spill_evt >;
         using data_stream = async_queue< evt_var >;
 
+        std::size_t mem_limit = 256 * 1024;
+        // buffers of output split from queued events, malloc'd if not set
+        buffer_pool* pool = nullptr;
+        // called once spilled output was read back or more of the log was written
+        std::function< void() > on_ready;
+
+        /// Creates the log at `path`, without it output is only held in memory
+        bool open_log( uv_loop_t* loop, std::string path )
+        {
+                _log.on_written = [this] {
+                        load_next();
+                        if ( on_ready )
+                                on_ready();
+                };
+                return _log.open( loop, std::move( path ) );
+        }
+
+        output_log const& log() const
+        {
+                return _log;
+        }
+
         void enque( stdout_evt item )
         {
-                _stream.enque( std::move( item ) );
+                enque_output( std::move( item ), false );
         }
         void enque( stderr_evt item )
         {
-                _stream.enque( std::move( item ) );
+                enque_output( std::move( item ), true );
         }
         void enque( exit_evt item )
         {
                 _exit_status.emplace( item.exit_status );
-                _stream.enque_all( std::move( item ) );
+                _stream.enque( std::move( item ) );
+                _arrived.set_value();
         }
 
         auto& exit_status()
@@ -89,31 +216,425 @@ struct proc_stream
                 return _exit_status;
         }
 
-        auto deque()
+        /// Waits until another event is queued, queued events are taken by try_deque()
+        auto arrival()
+        {
+                return _arrived.schedule();
+        }
+
+        /// First queued event, nullptr if there is none or spilled output is still read back
+        evt_var* front()
         {
-                return _stream.deque();
+                auto* front = _stream.front();
+                if ( !front || !std::holds_alternative< spill_evt >( *front ) )
+                        return front;
+                if ( _loaded )
+                        return &*_loaded;
+                if ( !spill_done() )
+                        return nullptr;
+                pop_spill();
+                return _stream.front();
+        }
+
+        /// Removes the first queued event, output beyond `max_n` bytes of it stays queued. Spilled
+        /// output is read back at most `spill_chunk` bytes at a time.
+        std::optional< evt_var >
+        try_deque( std::size_t max_n = std::numeric_limits< std::size_t >::max() )
+        {
+                if ( !this->front() )
+                        return std::nullopt;
+                auto* front = _stream.front();
+                if ( std::holds_alternative< spill_evt >( *front ) )
+                        return take_loaded( max_n );
+                if ( output_size( *front ) > max_n ) {
+                        auto e = split( *front, max_n );
+                        if ( e )
+                                _mem_bytes -= max_n;
+                        return e;
+                }
+                auto e = _stream.try_deque();
+                _mem_bytes -= output_size( *e );
+                return e;
+        }
+
+        std::size_t size() const
+        {
+                return _stream.size();
+        }
+
+        /// Bytes of output the next try_deque() returns
+        std::size_t front_size()
+        {
+                auto* e = front();
+                return e ? output_size( *e ) : 0;
+        }
+
+        /// Bytes of output held in memory
+        std::size_t mem_bytes() const
+        {
+                return _mem_bytes;
+        }
+
+        /// Output held in memory or waiting for its write to the log is over `mem_limit`
+        bool full() const
+        {
+                return ( !_log.writable() && _mem_bytes > mem_limit ) ||
+                       _log.pending() > mem_limit;
+        }
+
+        /// Bytes of output carried by the event
+        static std::size_t output_size( evt_var const& e )
+        {
+                if ( auto* x = std::get_if< stdout_evt >( &e ) )
+                        return x->mem.size;
+                if ( auto* x = std::get_if< stderr_evt >( &e ) )
+                        return x->mem.size;
+                return 0;
+        }
+
+        static bool is_exit( evt_var const& e )
+        {
+                return std::holds_alternative< exit_evt >( e );
+        }
+
+        /// Appends output of `e` to `into` if both are output of the same stream
+        static bool merge( evt_var& into, evt_var const& e )
+        {
+                if ( into.index() != e.index() )
+                        return false;
+                if ( auto* x = std::get_if< stdout_evt >( &into ) )
+                        return x->mem.append( std::get< stdout_evt >( e ).mem );
+                if ( auto* x = std::get_if< stderr_evt >( &into ) )
+                        return x->mem.append( std::get< stderr_evt >( e ).mem );
+                return false;
+        }
+
+        /// Buffer for `n` bytes of output, its memory is null if the allocation failed
+        mem_buff make_buff( std::size_t n )
+        {
+                if ( pool )
+                        return { *pool, pool->acquire( n ), n, buffer_pool::capacity_for( n ) };
+                return { (uint8_t*) malloc( n ), n };
         }
 
 private:
-        data_stream               _stream;
-        async_optional< int64_t > _exit_status;
+        // output of one stream stored in the log
+        struct spilled
+        {
+                bool     is_err;
+                uint64_t offset;
+                uint64_t size;
+        };
+
+        template < typename E >
+        void enque_output( E item, bool is_err )
+        {
+                std::size_t const         n = item.mem.size;
+                std::optional< uint64_t > offset;
+                if ( _log.is_open() )
+                        offset = _log.append( is_err, { item.mem.mem, n } );
+
+                // once output spills, all of it does until the spilled output is read back
+                if ( !_spill_queued &&
+                     ( !offset || _stream.size() == 0 || _mem_bytes + n <= mem_limit ) ) {
+                        _stream.enque( std::move( item ) );
+                        _mem_bytes += n;
+                        _arrived.set_value();
+                        return;
+                }
+                if ( !offset ) {
+                        spdlog::error( "Failed to spill, dropping {} bytes of output", n );
+                        return;
+                }
+                if ( !_spill_queued ) {
+                        _stream.enque( spill_evt{} );
+                        _spill_queued = true;
+                        _arrived.set_value();
+                }
+                auto* last = _spilled.empty() ? nullptr : &_spilled.back();
+                if ( last && last->is_err == is_err && last->offset + last->size == *offset )
+                        last->size += n;
+                else
+                        _spilled.push_back( { is_err, *offset, n } );
+                load_next();
+        }
+
+        /// Takes the first `n` bytes of the output of `e`, the rest stays in it
+        std::optional< evt_var > split( evt_var& e, std::size_t n )
+        {
+                auto*      out    = std::get_if< stdout_evt >( &e );
+                bool const is_err = out == nullptr;
+                mem_buff&  src    = out ? out->mem : std::get< stderr_evt >( e ).mem;
+                mem_buff   b      = make_buff( n );
+                if ( !b.mem ) {
+                        spdlog::error( "Failed to split {} bytes of queued output", n );
+                        return std::nullopt;
+                }
+                std::memcpy( b.mem, src.mem, n );
+                std::memmove( src.mem, src.mem + n, src.size - n );
+                src.size -= n;
+                if ( is_err )
+                        return stderr_evt{ std::move( b ) };
+                return stdout_evt{ std::move( b ) };
+        }
+
+        std::optional< evt_var > take_loaded( std::size_t max_n )
+        {
+                if ( !_loaded )
+                        return std::nullopt;
+                if ( output_size( *_loaded ) > max_n )
+                        return split( *_loaded, max_n );
+                auto e = std::exchange( _loaded, std::nullopt );
+                if ( spill_done() )
+                        pop_spill();
+                else
+                        load_next();
+                return e;
+        }
+
+        /// All spilled output was taken, the spill_evt can go
+        bool spill_done() const
+        {
+                return _spilled.empty() && !_loaded && !_loading;
+        }
+
+        void pop_spill()
+        {
+                _stream.try_deque();
+                _spill_queued = false;
+        }
+
+        /// Reads back the next chunk of spilled output once it was written to the log
+        void load_next()
+        {
+                if ( _loading || _loaded || _spilled.empty() )
+                        return;
+                auto&             sp = _spilled.front();
+                std::size_t const n  = std::min< uint64_t >( sp.size, spill_chunk );
+                if ( sp.offset + n > _log.written() && _log.writable() )
+                        return;
+                bool const is_err = sp.is_err;
+                auto       done   = [this, is_err, n]( uint8_t* m, std::size_t r ) {
+                        _loading = false;
+                        on_loaded( is_err, n, m, r );
+                };
+                _loading = _log.read_back( sp.offset, n, std::move( done ) );
+                if ( !_loading )
+                        on_loaded( is_err, n, nullptr, 0 );
+        }
+
+        void on_loaded( bool is_err, std::size_t n, uint8_t* m, std::size_t r )
+        {
+                auto& sp = _spilled.front();
+                if ( !m || r != n ) {
+                        spdlog::error( "Failed to read back {} bytes of spilled output", n );
+                        free( m );
+                        sp.size = 0;
+                } else {
+                        mem_buff b{ m, n };
+                        if ( is_err )
+                                _loaded.emplace( stderr_evt{ std::move( b ) } );
+                        else
+                                _loaded.emplace( stdout_evt{ std::move( b ) } );
+                        sp.offset += n;
+                        sp.size -= n;
+                }
+                if ( sp.size == 0 )
+                        _spilled.pop_front();
+                if ( !_loaded && !_spilled.empty() )
+                        return load_next();
+                // the spill_evt of output that failed to load is dropped by front()
+                _arrived.set_value();
+                if ( on_ready )
+                        on_ready();
+        }
+
+        data_stream                                   _stream;
+        ecor::broadcast_source< ecor::set_value_t() > _arrived;
+        async_optional< int64_t >                     _exit_status;
+        std::size_t                                   _mem_bytes = 0;
+        std::deque< spilled >                         _spilled;
+        // chunk of spilled output read back, taken in place of the spill_evt
+        std::optional< evt_var > _loaded;
+        bool                     _loading      = false;
+        bool                     _spill_queued = false;
+        output_log               _log;
+};
+
+/// Receiver of the output of subscribed tasks
+struct output_sink
+{
+        virtual void push( uint32_t task_id, proc_stream::evt_var& evt ) = 0;
+
+        /// False while the sink can not take more events, it schedules a tick of the owner of the
+        /// tasks once it can. Events stay queued in the tasks meanwhile.
+        virtual bool writable()
+        {
+                return true;
+        }
+};
+
+/// What a task runs, owned by the task so that it can wait in the queue
+struct task_spec
+{
+        std::string                binary;
+        std::string                cwd;
+        std::vector< std::string > args;
+        // NAME=value overrides of the unit environment
+        std::vector< std::string > env;
+        // runs `args` in a warm shell of `cwd`, `binary` and `env` are not used
+        bool warm = false;
+        // queued tasks of higher priority are started first
+        uint32_t priority = 0;
+        // CPU share relative to 100 like cgroup cpu.weight, 0 leaves the default
+        uint32_t cpu_weight = 0;
+};
+
+enum class proc_state
+{
+        queued,
+        running,
+        exited
+};
+
+/// Stops the process groups of tasks, SIGTERM first and SIGKILL once the grace period passed.
+/// What is left of a group whose leader exited after SIGTERM is killed right away.
+struct group_killer
+{
+        uint64_t grace_ms = 5000;
+
+        group_killer( uv_loop_t* loop )
+          : _loop( loop )
+        {
+                _timer.data = this;
+                uv_timer_init( loop, &_timer );
+        }
+
+        /// Sends SIGTERM to the group led by `pid`
+        void terminate( int pid )
+        {
+                if ( std::ranges::find( _pending, pid, &entry::pid ) != _pending.end() )
+                        return;
+                signal( pid, SIGTERM );
+                _pending.push_back( { uv_now( _loop ) + grace_ms, pid } );
+                if ( !uv_is_active( (uv_handle_t*) &_timer ) )
+                        arm();
+        }
+
+        /// Called once the leader `pid` was reaped, before its pid can be reused
+        void exited( int pid )
+        {
+                auto it = std::ranges::find( _pending, pid, &entry::pid );
+                if ( it == _pending.end() )
+                        return;
+                signal( pid, SIGKILL );
+                _pending.erase( it );
+        }
+
+        void close()
+        {
+                uv_close( (uv_handle_t*) &_timer, nullptr );
+        }
+
+private:
+        struct entry
+        {
+                uint64_t deadline;
+                int      pid;
+        };
+
+        static void signal( int pid, int signum )
+        {
+                if ( int e = uv_kill( -pid, signum ); e < 0 && e != UV_ESRCH )
+                        spdlog::error(
+                            "Failed to signal process group {}: {}", pid, uv_strerror( e ) );
+        }
+
+        void arm()
+        {
+                uint64_t const now = uv_now( _loop );
+                uint64_t const at  = _pending.front().deadline;
+                uv_timer_start( &_timer, on_timer, at > now ? at - now : 0, 0 );
+        }
+
+        static void on_timer( uv_timer_t* t )
+        {
+                auto&          self = *static_cast< group_killer* >( t->data );
+                uint64_t const now  = uv_now( self._loop );
+                while ( !self._pending.empty() && self._pending.front().deadline <= now ) {
+                        int const pid = self._pending.front().pid;
+                        spdlog::warn( "Process group {} outlived the grace period", pid );
+                        signal( pid, SIGKILL );
+                        self._pending.pop_front();
+                }
+                if ( !self._pending.empty() )
+                        self.arm();
+        }
+
+        uv_loop_t*          _loop;
+        uv_timer_t          _timer;
+        std::deque< entry > _pending;
 };
 
+struct shell_worker;
+
 struct proc : zll::ll_base< proc >
 {
+        uint32_t              task_id;
         uv_loop_t*            loop;
         zll::ll_list< proc >& finished_procs;
+        component&            owner;
+        buffer_pool&          pool;
+        group_killer&         killer;
+        reap_ledger&          reaps;
 
-        uv_process_t         process;
+        // set once the task is subscribed, events are pushed to it while there is credit
+        output_sink* sink   = nullptr;
+        uint64_t     credit = 0;
+
+        // data is set once the process was spawned
+        uv_process_t         process = {};
         uv_process_options_t options = {};
         uv_stdio_container_t stdio[3];
         uv_pipe_t            stdin_pipe, stdout_pipe, stderr_pipe;
         proc_stream          stream;
+        // warm shell running the task, unset once it finished
+        shell_worker* worker = nullptr;
+        proc_state    state  = proc_state::queued;
+        task_spec     spec;
+        // sampled while the task runs, final once it exited
+        proc_usage usage;
+        uint64_t   started_ns = 0;
+        // reading of the output is stopped by throttle()
+        bool paused = false;
+        // exit status of the process reaped, reported once its usage was charged
+        std::optional< int > reaped_status;
+        // handles being closed by destroy() of a task that never started
+        int                                           closing = 0;
+        ecor::broadcast_source< ecor::set_value_t() > closed;
 
-        proc( async_ptr_source< proc >, uv_loop_t* loop, zll::ll_list< proc >& finished_procs )
-          : loop( loop )
+        proc(
+            async_ptr_source< proc >,
+            uint32_t              task_id,
+            uv_loop_t*            loop,
+            zll::ll_list< proc >& finished_procs,
+            component&            owner,
+            buffer_pool&          pool,
+            group_killer&         killer,
+            reap_ledger&          reaps )
+          : task_id( task_id )
+          , loop( loop )
           , finished_procs( finished_procs )
+          , owner( owner )
+          , pool( pool )
+          , killer( killer )
+          , reaps( reaps )
         {
+                stream.pool     = &pool;
+                stream.on_ready = [this] {
+                        pump();
+                        throttle();
+                };
                 uv_pipe_init( loop, &stdin_pipe, 0 );
                 uv_pipe_init( loop, &stdout_pipe, 0 );
                 uv_pipe_init( loop, &stderr_pipe, 0 );
@@ -125,7 +646,14 @@ struct proc : zll::ll_base< proc >
                         spdlog::info(
                             "Process exited with status {}, signal {}", exit_status, term_signal );
                         auto& self = *static_cast< proc* >( process->data );
-                        self.on_exit( exit_status, term_signal );
+                        // libuv reaped the process just now, its pid is not sampled anymore
+                        self.state = proc_state::exited;
+                        self.reaps.reaped_task( self.task_id );
+                        self.killer.exited( self.process.pid );
+                        // the exit is reported by the tick that charges the usage reaped
+                        self.reaped_status = exit_status;
+                        self.finished_procs.link_back( self );
+                        self.owner.schedule_tick();
                         uv_close( (uv_handle_t*) process, NULL );
                 };
                 options.stdio_count  = std::size( stdio );
@@ -137,46 +665,95 @@ struct proc : zll::ll_base< proc >
                 stdio[2].data.stream = (uv_stream_t*) &stderr_pipe;
         }
 
-        static void alloc_read_stream( uv_handle_t*, size_t suggested_size, uv_buf_t* buf )
+        static void alloc_read_stream( uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf )
         {
-                buf->base = (char*) malloc( suggested_size );
-                buf->len  = suggested_size;
+                auto& self = *static_cast< proc* >( handle->data );
+                buf->base  = (char*) self.pool.acquire( suggested_size );
+                buf->len   = buf->base ? buffer_pool::capacity_for( suggested_size ) : 0;
         }
 
         template < bool is_err >
         static void on_msg( uv_stream_t* stream, ssize_t nread, uv_buf_t const* buf )
         {
                 spdlog::debug( "Received message on stream: {} bytes", nread );
-                if ( nread < 0 ) {
+                auto& s = *static_cast< proc* >( stream->data );
+                if ( nread <= 0 ) {
+                        s.pool.release( (uint8_t*) buf->base, buf->len );
+                        if ( nread == 0 )
+                                return;
                         if ( nread != UV_EOF )
                                 spdlog::error( "Read error {}", uv_err_name( nread ) );
-                        free( buf->base );
                         uv_close( (uv_handle_t*) stream, nullptr );
                         return;
                 }
-                auto& s = *static_cast< proc* >( stream->data );
+                mem_buff b{ s.pool, (uint8_t*) buf->base, (size_t) nread, buf->len };
+                // reads are mostly much smaller than the buffer libuv asks for
+                b.fit();
                 if ( is_err )
-                        s.stream.enque(
-                            proc_stream::stderr_evt{
-                                mem_buff{ (uint8_t*) buf->base, (size_t) nread } } );
+                        s.stream.enque( proc_stream::stderr_evt{ std::move( b ) } );
                 else
-                        s.stream.enque(
-                            proc_stream::stdout_evt{
-                                mem_buff{ (uint8_t*) buf->base, (size_t) nread } } );
+                        s.stream.enque( proc_stream::stdout_evt{ std::move( b ) } );
+                s.pump();
+                s.throttle();
         }
 
         void on_exit( int exit_status, int )
         {
-                stream.enque( proc_stream::exit_evt{ exit_status } );
+                exited( exit_status );
                 finished_procs.link_back( *this );
+                owner.schedule_tick();
+        }
+
+        /// Reports the exit of the task
+        void exited( int exit_status )
+        {
+                state = proc_state::exited;
+                if ( started_ns != 0 )
+                        usage.wall_us = ( uv_hrtime() - started_ns ) / 1000;
+                stream.enque( proc_stream::exit_evt{ exit_status } );
+                pump();
+        }
+
+        /// Stops reading the output of the task while its stream is full() and resumes once it is
+        /// not, the task blocks on its writes meanwhile
+        void throttle();
+
+        /// Pushes queued events to the subscriber in order. Output is charged to the credit by its
+        /// size, the last chunk may overdraw it. The exit status ends the subscription.
+        void pump()
+        {
+                while ( sink && sink->writable() ) {
+                        auto* front = stream.front();
+                        if ( !front )
+                                return;
+                        bool const is_exit = proc_stream::is_exit( *front );
+                        if ( !is_exit && credit == 0 )
+                                return;
+                        auto opt_evt = stream.try_deque();
+                        if ( !opt_evt )
+                                continue;
+                        auto& evt = *opt_evt;
+                        credit -= std::min< uint64_t >( credit, proc_stream::output_size( evt ) );
+                        auto* s = sink;
+                        if ( is_exit )
+                                sink = nullptr;
+                        s->push( task_id, evt );
+                }
         }
 
-        bool start( char const* binary, char const* cwd, char** args )
+        /// Spawns `binary`, looked up in PATH unless it contains a slash. The environment of the
+        /// unit is inherited if `env` is null.
+        bool start( char const* binary, char const* cwd, char** args, char** env = nullptr )
         {
-                process.data = this;
-                options.file = binary;
-                options.args = args;
-                options.cwd  = cwd;
+                process.data  = this;
+                options.file  = binary;
+                options.args  = args;
+                options.cwd   = cwd;
+                options.env   = env;
+                // own process group, so that cancel reaches everything the task started
+                options.flags = UV_PROCESS_DETACHED;
+                // the output log stays next to the files of the task
+                stream.open_log( loop, std::format( "{}/.task_{}.out", cwd, task_id ) );
                 spdlog::info( "Starting: {}{} in folder: {}", binary, joined( args ), cwd );
                 if ( int e = uv_spawn( loop, &process, &options ); e < 0 ) {
                         spdlog::error( "uv_spawn failed: {}", uv_strerror( e ) );
@@ -196,97 +773,795 @@ struct proc : zll::ll_base< proc >
                      e < 0 ) {
                         spdlog::error( "uv_read_start stderr failed: {}", uv_strerror( e ) );
                 }
+                state      = proc_state::running;
+                started_ns = uv_hrtime();
                 return true;
         }
 
+        /// Runs `args` in the warm shell `w` of folder `cwd` instead of spawning a process
+        bool start_in( shell_worker& w, char const* cwd, char** args );
+
         proc( proc const& )            = delete;
         proc& operator=( proc const& ) = delete;
         proc( proc&& )                 = delete;
         proc& operator=( proc&& )      = delete;
 };
 
+struct shell_pool;
+
+/// Login shell kept running in a folder, it runs commands of warm tasks one at a time so they do
+/// not pay for the start of a login shell. A command is written to its stdin as NUL terminated
+/// nonce, argument count and arguments. Its end is marked on stdout by the nonce followed by the
+/// exit status and on stderr by the nonce alone.
+struct shell_worker
+{
+        static constexpr char const* script = R"(
+while IFS= read -r -d '' nonce && IFS= read -r -d '' argc; do
+        args=()
+        for (( i = 0; i < argc; i++ )); do
+                IFS= read -r -d '' arg
+                args+=( "$arg" )
+        done
+        ( exec "${args[@]}" ) < /dev/null
+        status=$?
+        printf '\0trctl:%s:%d\0' "$nonce" "$status"
+        printf '\0trctl:%s\0' "$nonce" >&2
+done
+)";
+
+        shell_pool&          shells;
+        std::string          cwd;
+        uv_process_t         process;
+        uv_process_options_t options = {};
+        uv_stdio_container_t stdio[3];
+        uv_pipe_t            in, out, err;
+        uv_write_t           write_req;
+
+        // task of the command being run
+        proc* current = nullptr;
+        bool  idle    = false;
+        bool  exited  = false;
+
+        shell_worker( shell_pool& shells, uv_loop_t* loop, std::string cwd );
+
+        bool spawn( uv_loop_t* loop );
+        /// Starts `args` as the command of `p`, false if it could not be sent to the shell
+        bool run( proc& p, std::string const& nonce, char** args );
+        /// Stops the shell together with the command it runs
+        void kill();
+        /// Stops or resumes reading the output of the command
+        void pause( bool stop );
+
+        shell_worker( shell_worker const& )            = delete;
+        shell_worker& operator=( shell_worker const& ) = delete;
+
+private:
+        static void alloc_read( uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf );
+        template < bool is_err >
+        static void on_read( uv_stream_t* stream, ssize_t nread, uv_buf_t const* buf );
+        void on_output( bool is_err, std::string_view data );
+        void forward( bool is_err, std::string_view data );
+        void finish( int64_t exit_status, int term_signal );
+        void close();
+
+        char* _args[5];
+        // command being written to the shell
+        std::string _cmd;
+        // end of the current command, a read ending in a prefix of it is held back
+        std::string _marker;
+        std::string _carry[2];
+        bool        _done[2]      = {};
+        bool        _paused       = false;
+        int64_t     _status       = 0;
+        int         _open_handles = 0;
+};
+
+/// Warm shells of all folders. A warm task takes an idle shell of its folder or starts a new one,
+/// a spare shell is started whenever the folder has no idle one left.
+///
+/// A warm task saves the start of a login shell only, and it has these limits:
+///  - each command still runs in a subshell forked by the shell, so that a command cannot change
+///    the state of the shell for the commands after it
+///  - the task has no process of its own, it is not sampled and its usage holds the wall time only
+///  - cancelling the task kills the process group of its shell, the next warm task of the folder
+///    takes another shell
+struct shell_pool
+{
+        uv_loop_t*    loop;
+        buffer_pool&  buffs;
+        group_killer& killer;
+        reap_ledger&  reaps;
+        // idle shells kept per folder, more are stopped once their command finished
+        std::size_t max_idle = 2;
+
+        shell_pool( uv_loop_t* loop, buffer_pool& buffs, group_killer& killer, reap_ledger& reaps )
+          : loop( loop )
+          , buffs( buffs )
+          , killer( killer )
+          , reaps( reaps )
+          , _seed( std::random_device{}() )
+        {
+        }
+
+        /// Shell to run the next command in folder `cwd`, nullptr if none could be started
+        shell_worker* acquire( std::string const& cwd )
+        {
+                shell_worker* w = nullptr;
+                for ( auto& x : _workers ) {
+                        if ( x.idle && x.cwd == cwd ) {
+                                w = &x;
+                                break;
+                        }
+                }
+                if ( w )
+                        w->idle = false;
+                else
+                        w = spawn( cwd );
+                if ( w && idle_in( cwd ) == 0 ) {
+                        if ( auto* spare = spawn( cwd ) )
+                                spare->idle = true;
+                }
+                return w;
+        }
+
+        /// Takes `w` back once its command finished
+        void release( shell_worker& w )
+        {
+                if ( idle_in( w.cwd ) >= max_idle )
+                        w.kill();
+                else
+                        w.idle = true;
+        }
+
+        /// Unique marker of one command
+        std::string next_nonce()
+        {
+                return std::format( "{:016x}{:08x}", _seed, ++_next );
+        }
+
+        void closed( shell_worker& w )
+        {
+                std::erase_if( _workers, [&]( auto& x ) {
+                        return &x == &w;
+                } );
+                _closed.set_value();
+        }
+
+        std::size_t size() const
+        {
+                return _workers.size();
+        }
+
+        task< void > shutdown()
+        {
+                for ( auto& w : _workers )
+                        w.kill();
+                while ( !_workers.empty() )
+                        co_await _closed.schedule();
+        }
+
+private:
+        std::size_t idle_in( std::string const& cwd ) const
+        {
+                return std::ranges::count_if( _workers, [&]( auto& x ) {
+                        return x.idle && x.cwd == cwd;
+                } );
+        }
+
+        shell_worker* spawn( std::string const& cwd )
+        {
+                auto& w = _workers.emplace_back( *this, loop, cwd );
+                if ( !w.spawn( loop ) )
+                        return nullptr;
+                return &w;
+        }
+
+        std::list< shell_worker >                     _workers;
+        uint64_t                                      _seed;
+        uint64_t                                      _next = 0;
+        ecor::broadcast_source< ecor::set_value_t() > _closed;
+};
+
+inline shell_worker::shell_worker( shell_pool& shells, uv_loop_t* loop, std::string cwd )
+  : shells( shells )
+  , cwd( std::move( cwd ) )
+{
+        process.data = in.data = out.data = err.data = this;
+        uv_pipe_init( loop, &in, 0 );
+        uv_pipe_init( loop, &out, 0 );
+        uv_pipe_init( loop, &err, 0 );
+
+        _args[0] = (char*) "/bin/bash";
+        _args[1] = (char*) "--login";
+        _args[2] = (char*) "-c";
+        _args[3] = (char*) script;
+        _args[4] = nullptr;
+
+        options.file = _args[0];
+        options.args = _args;
+        options.cwd  = this->cwd.c_str();
+        // own process group, so the command goes down with the shell
+        options.flags   = UV_PROCESS_DETACHED;
+        options.stdio   = stdio;
+        options.exit_cb = +[]( uv_process_t* process, int64_t exit_status, int term_signal ) {
+                auto& self = *static_cast< shell_worker* >( process->data );
+                spdlog::info(
+                    "Shell of folder {} exited with status {}, signal {}",
+                    self.cwd,
+                    exit_status,
+                    term_signal );
+                self.exited = true;
+                self.idle   = false;
+                // the shell is not a task, its usage is not charged to one reaped along with it
+                self.shells.reaps.reaped_other();
+                self.shells.killer.exited( process->pid );
+                if ( self.current )
+                        self.finish( exit_status, term_signal );
+                self.close();
+        };
+        options.stdio_count  = std::size( stdio );
+        stdio[0].flags       = (uv_stdio_flags) ( UV_CREATE_PIPE | UV_READABLE_PIPE );
+        stdio[0].data.stream = (uv_stream_t*) &in;
+        stdio[1].flags       = (uv_stdio_flags) ( UV_CREATE_PIPE | UV_WRITABLE_PIPE );
+        stdio[1].data.stream = (uv_stream_t*) &out;
+        stdio[2].flags       = (uv_stdio_flags) ( UV_CREATE_PIPE | UV_WRITABLE_PIPE );
+        stdio[2].data.stream = (uv_stream_t*) &err;
+}
+
+inline bool shell_worker::spawn( uv_loop_t* loop )
+{
+        spdlog::info( "Starting warm shell in folder: {}", cwd );
+        if ( int e = uv_spawn( loop, &process, &options ); e < 0 ) {
+                spdlog::error( "uv_spawn of shell failed: {}", uv_strerror( e ) );
+                exited = true;
+                close();
+                return false;
+        }
+        if ( int e = uv_read_start( (uv_stream_t*) &out, alloc_read, on_read< false > ); e < 0 )
+                spdlog::error( "uv_read_start of shell stdout failed: {}", uv_strerror( e ) );
+        if ( int e = uv_read_start( (uv_stream_t*) &err, alloc_read, on_read< true > ); e < 0 )
+                spdlog::error( "uv_read_start of shell stderr failed: {}", uv_strerror( e ) );
+        return true;
+}
+
+inline void shell_worker::alloc_read( uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf )
+{
+        auto& self = *static_cast< shell_worker* >( handle->data );
+        buf->base  = (char*) self.shells.buffs.acquire( suggested_size );
+        buf->len   = buf->base ? buffer_pool::capacity_for( suggested_size ) : 0;
+}
+
+inline bool shell_worker::run( proc& p, std::string const& nonce, char** args )
+{
+        std::size_t argc = 0;
+        while ( args[argc] )
+                ++argc;
+
+        _cmd.clear();
+        _cmd.append( nonce ).push_back( '\0' );
+        _cmd.append( std::to_string( argc ) ).push_back( '\0' );
+        for ( std::size_t i = 0; i < argc; ++i )
+                _cmd.append( args[i] ).push_back( '\0' );
+
+        uv_buf_t buf = uv_buf_init( _cmd.data(), _cmd.size() );
+        auto     cb  = +[]( uv_write_t* req, int status ) {
+                if ( status >= 0 )
+                        return;
+                spdlog::error( "Write of command to shell failed: {}", uv_strerror( status ) );
+                static_cast< shell_worker* >( req->handle->data )->kill();
+        };
+        if ( int e = uv_write( &write_req, (uv_stream_t*) &in, &buf, 1, cb ); e < 0 ) {
+                spdlog::error( "uv_write of command to shell failed: {}", uv_strerror( e ) );
+                kill();
+                return false;
+        }
+        _marker.assign( "\0trctl:", 7 ).append( nonce );
+        _carry[0].clear();
+        _carry[1].clear();
+        _done[0] = _done[1] = false;
+        _status             = 0;
+        current             = &p;
+        return true;
+}
+
+inline void shell_worker::kill()
+{
+        if ( exited )
+                return;
+        shells.killer.terminate( process.pid );
+}
+
+inline void shell_worker::pause( bool stop )
+{
+        _paused = stop;
+        if ( exited )
+                return;
+        if ( stop ) {
+                uv_read_stop( (uv_stream_t*) &out );
+                uv_read_stop( (uv_stream_t*) &err );
+                return;
+        }
+        if ( int e = uv_read_start( (uv_stream_t*) &out, alloc_read, on_read< false > ); e < 0 )
+                spdlog::error( "uv_read_start of shell stdout failed: {}", uv_strerror( e ) );
+        if ( int e = uv_read_start( (uv_stream_t*) &err, alloc_read, on_read< true > ); e < 0 )
+                spdlog::error( "uv_read_start of shell stderr failed: {}", uv_strerror( e ) );
+}
+
+template < bool is_err >
+void shell_worker::on_read( uv_stream_t* stream, ssize_t nread, uv_buf_t const* buf )
+{
+        auto& self = *static_cast< shell_worker* >( stream->data );
+        if ( nread < 0 ) {
+                if ( nread != UV_EOF )
+                        spdlog::error( "Shell read error {}", uv_err_name( nread ) );
+                uv_read_stop( stream );
+        } else if ( nread > 0 ) {
+                self.on_output( is_err, { buf->base, (std::size_t) nread } );
+        }
+        self.shells.buffs.release( (uint8_t*) buf->base, buf->len );
+}
+
+inline void shell_worker::on_output( bool is_err, std::string_view data )
+{
+        std::string buff;
+        if ( !_carry[is_err].empty() ) {
+                buff = std::move( _carry[is_err] );
+                buff.append( data );
+                _carry[is_err].clear();
+                data = buff;
+        }
+        if ( !current || _done[is_err] ) {
+                spdlog::warn( "Dropping {} bytes of shell output outside of a task", data.size() );
+                return;
+        }
+
+        auto const pos = data.find( _marker );
+        if ( pos == std::string_view::npos ) {
+                std::size_t keep = std::min( data.size(), _marker.size() - 1 );
+                while ( keep > 0 && !_marker.starts_with( data.substr( data.size() - keep ) ) )
+                        --keep;
+                forward( is_err, data.substr( 0, data.size() - keep ) );
+                _carry[is_err] = data.substr( data.size() - keep );
+                return;
+        }
+        forward( is_err, data.substr( 0, pos ) );
+
+        std::size_t const tail = pos + _marker.size();
+        std::size_t const end  = data.find( '\0', tail );
+        if ( end == std::string_view::npos ) {
+                _carry[is_err] = data.substr( pos );
+                return;
+        }
+        // the stdout marker ends with ":<status>"
+        if ( !is_err && end > tail )
+                std::from_chars( data.data() + tail + 1, data.data() + end, _status );
+        _done[is_err] = true;
+        if ( _done[0] && _done[1] )
+                finish( _status, 0 );
+}
+
+inline void shell_worker::forward( bool is_err, std::string_view data )
+{
+        if ( data.empty() )
+                return;
+        auto b = current->stream.make_buff( data.size() );
+        if ( !b.mem ) {
+                spdlog::error( "Failed to allocate, dropping {} bytes of output", data.size() );
+                return;
+        }
+        std::memcpy( b.mem, data.data(), data.size() );
+        if ( is_err )
+                current->stream.enque( proc_stream::stderr_evt{ std::move( b ) } );
+        else
+                current->stream.enque( proc_stream::stdout_evt{ std::move( b ) } );
+        current->pump();
+        current->throttle();
+}
+
+inline void shell_worker::finish( int64_t exit_status, int term_signal )
+{
+        auto* p   = current;
+        current   = nullptr;
+        p->worker = nullptr;
+        // the next command starts with its output read
+        if ( _paused )
+                pause( false );
+        if ( !exited )
+                shells.release( *this );
+        p->on_exit( exit_status, term_signal );
+}
+
+inline void shell_worker::close()
+{
+        auto on_closed = +[]( uv_handle_t* handle ) {
+                auto& self = *static_cast< shell_worker* >( handle->data );
+                if ( --self._open_handles == 0 )
+                        self.shells.closed( self );
+        };
+        for ( auto* h : { (uv_handle_t*) &process,
+                          (uv_handle_t*) &in,
+                          (uv_handle_t*) &out,
+                          (uv_handle_t*) &err } ) {
+                if ( uv_is_closing( h ) )
+                        continue;
+                ++_open_handles;
+                uv_close( h, on_closed );
+        }
+}
+
+inline void proc::throttle()
+{
+        bool const full = stream.full();
+        if ( full == paused || state == proc_state::queued )
+                return;
+        paused = full;
+        if ( worker ) {
+                worker->pause( full );
+                return;
+        }
+        for ( auto* pipe : { &stdout_pipe, &stderr_pipe } ) {
+                if ( uv_is_closing( (uv_handle_t*) pipe ) )
+                        continue;
+                if ( full ) {
+                        uv_read_stop( (uv_stream_t*) pipe );
+                        continue;
+                }
+                auto* cb = pipe == &stdout_pipe ? on_msg< false > : on_msg< true >;
+                if ( int e = uv_read_start( (uv_stream_t*) pipe, alloc_read_stream, cb ); e < 0 )
+                        spdlog::error( "uv_read_start of output failed: {}", uv_strerror( e ) );
+        }
+}
+
+inline bool proc::start_in( shell_worker& w, char const* cwd, char** args )
+{
+        // output of the task arrives through the pipes of the shell
+        uv_close( (uv_handle_t*) &stdin_pipe, nullptr );
+        uv_close( (uv_handle_t*) &stdout_pipe, nullptr );
+        uv_close( (uv_handle_t*) &stderr_pipe, nullptr );
+        stream.open_log( loop, std::format( "{}/.task_{}.out", cwd, task_id ) );
+        spdlog::info( "Starting:{} in warm shell of folder: {}", joined( args ), cwd );
+        if ( !w.run( *this, w.shells.next_nonce(), args ) )
+                return false;
+        worker     = &w;
+        state      = proc_state::running;
+        started_ns = uv_hrtime();
+        return true;
+}
+
 task< void > destroy( auto&, proc& p )
 {
+        if ( p.state == proc_state::queued ) {
+                // never spawned, only its pipes are open
+                for ( auto* pipe : { &p.stdin_pipe, &p.stdout_pipe, &p.stderr_pipe } ) {
+                        if ( uv_is_closing( (uv_handle_t*) pipe ) )
+                                continue;
+                        pipe->data = &p;
+                        ++p.closing;
+                        uv_close( (uv_handle_t*) pipe, []( uv_handle_t* h ) {
+                                auto& self = *static_cast< proc* >( h->data );
+                                if ( --self.closing == 0 )
+                                        self.closed.set_value();
+                        } );
+                }
+                while ( p.closing != 0 )
+                        co_await p.closed.schedule();
+                co_return;
+        }
+        if ( p.worker ) {
+                // the command can not be stopped apart from its shell
+                p.worker->kill();
+                co_await p.stream.exit_status();
+                co_return;
+        }
         if ( !p.process.data )
                 co_return;
 
         uv_read_stop( (uv_stream_t*) &p.stdout_pipe );
         uv_read_stop( (uv_stream_t*) &p.stderr_pipe );
-        uv_process_kill( &p.process, SIGTERM );
+        // nothing resumes the reads
+        p.stream.on_ready = nullptr;
+        // a reaped task is not signalled, its pid may belong to another process by now
+        if ( p.state == proc_state::running )
+                p.killer.terminate( p.process.pid );
 
         co_await p.stream.exit_status();
 
         p.process.data = nullptr;
 }
 
+/// Environment of the unit with `overrides` of form NAME=value replacing or adding variables
+inline std::vector< std::string > merged_env( std::span< std::string const > overrides )
+{
+        auto name_of = []( std::string_view var ) {
+                return var.substr( 0, var.find( '=' ) );
+        };
+        std::vector< std::string > res;
+        for ( char** e = environ; *e; ++e ) {
+                bool const replaced = std::ranges::any_of( overrides, [&]( auto const& o ) {
+                        return name_of( o ) == name_of( *e );
+                } );
+                if ( !replaced )
+                        res.emplace_back( *e );
+        }
+        res.insert( res.end(), overrides.begin(), overrides.end() );
+        return res;
+}
+
+/// Nice value that gives a task `weight` / 100 of the CPU share of a default one, each nice step
+/// is worth a factor of 1.25
+inline int nice_of( uint32_t weight )
+{
+        double const n = -std::log( weight / 100.0 ) / std::log( 1.25 );
+        return std::clamp( (int) std::lround( n ), -20, 19 );
+}
+
 struct proc_ctx : comp_buff, component
 {
-        uint8_t                     proc_mem[1024];
+        uint8_t proc_mem[1024];
+        // pipe read buffers of all tasks, outlives them
+        buffer_pool pool;
+        // stops process groups of tasks and shells, outlives them
+        group_killer killer;
+        // children reaped since the last tick, outlives the tasks and shells
+        reap_ledger reaps;
+        // shells of warm tasks, outlive them
+        shell_pool                  shells;
         async_map< uint32_t, proc > procs;
 
         proc_ctx( uv_loop_t* loop, task_core& core )
           : component( loop, core, comp_buff::buffer )
+          , killer( loop )
+          , shells( loop, pool, killer, reaps )
           , procs( loop, core, proc_mem )
         {
+                _sampler.data = this;
+                uv_timer_init( loop, &_sampler );
         }
 
         void tick() override
         {
                 clear_procs( finished_procs );
+                admit();
+                for ( auto it = procs.begin(); it != procs.end(); ++it ) {
+                        it->second->pump();
+                        it->second->throttle();
+                }
         }
 
         task< void > shutdown() override
         {
-                spdlog::info( "Shutting down procs: {} procs", procs.size() );
+                spdlog::info(
+                    "Shutting down procs: {} procs, {} queued", procs.size(), _queue.size() );
+                _queue.clear();
+                // the tasks are destroyed one by one, all of them get the grace period at once
+                for ( auto it = procs.begin(); it != procs.end(); ++it ) {
+                        auto& p = *it->second;
+                        if ( p.state == proc_state::running && !p.worker )
+                                killer.terminate( p.process.pid );
+                }
                 co_await procs.shutdown();
-                spdlog::info( "All procs killed" );
+                spdlog::info( "All procs killed, stopping {} shells", shells.size() );
+                co_await shells.shutdown();
+                killer.close();
+                uv_close( (uv_handle_t*) &_sampler, nullptr );
+                auto& st = pool.get_stats();
+                spdlog::info(
+                    "Output buffers: {} acquired, {} mallocs, {} frees, {} bytes cached",
+                    st.acquired,
+                    st.mallocs,
+                    st.frees,
+                    st.cached_bytes );
                 co_return;
         }
 
+        std::size_t running()
+        {
+                std::size_t n = 0;
+                for ( auto it = procs.begin(); it != procs.end(); ++it )
+                        n += it->second->state == proc_state::running;
+                return n;
+        }
+
+        bool is_queued( uint32_t task_id )
+        {
+                auto it = procs.find( task_id );
+                return it != procs.end() && it->second->state == proc_state::queued;
+        }
+
+        /// True if a new task has to wait in the queue
+        bool must_queue()
+        {
+                return !_queue.empty() || ( max_running != 0 && running() >= max_running );
+        }
+
+        /// Queues `p` behind the queued tasks of the same or higher priority
+        void enqueue( proc& p )
+        {
+                _queue.emplace( p.spec.priority, p.task_id );
+                schedule_tick();
+        }
+
+        void dequeue( uint32_t task_id )
+        {
+                std::erase_if( _queue, [&]( auto& x ) {
+                        return x.second == task_id;
+                } );
+        }
+
+        /// Spawns the process of `p` as described by its spec
+        bool launch( proc& p )
+        {
+                auto&                s = p.spec;
+                std::vector< char* > argv;
+                for ( auto& a : s.args )
+                        argv.push_back( a.data() );
+                argv.push_back( nullptr );
+                if ( s.warm ) {
+                        auto* w = shells.acquire( s.cwd );
+                        return w && p.start_in( *w, s.cwd.c_str(), argv.data() );
+                }
+
+                // the child copies the environment when it is spawned, it is not needed afterwards
+                std::vector< std::string > vars;
+                std::vector< char* >       envp;
+                if ( !s.env.empty() ) {
+                        vars = merged_env( s.env );
+                        for ( auto& v : vars )
+                                envp.push_back( v.data() );
+                        envp.push_back( nullptr );
+                }
+                if ( !p.start(
+                         s.binary.c_str(),
+                         s.cwd.c_str(),
+                         argv.data(),
+                         envp.empty() ? nullptr : envp.data() ) )
+                        return false;
+                start_sampling();
+                if ( s.cpu_weight != 0 ) {
+                        int const prio = nice_of( s.cpu_weight );
+                        if ( int e = uv_os_setpriority( p.process.pid, prio ); e < 0 )
+                                spdlog::warn(
+                                    "Failed to set priority {} of task {}: {}",
+                                    prio,
+                                    p.task_id,
+                                    uv_strerror( e ) );
+                }
+                return true;
+        }
+
         zll::ll_list< proc > finished_procs;
+        // where subscribed tasks push their output
+        output_sink* sink = nullptr;
+        // output of every task held in memory, the rest spills to disk
+        std::size_t output_mem_limit = 256 * 1024;
+        // tasks running at once, 0 for no limit, further starts wait in the queue
+        std::size_t max_running = 0;
+        // /proc shows the usage of a process only while it runs, running tasks are sampled
+        static constexpr uint64_t sample_ms = 200;
 
 private:
+        void start_sampling()
+        {
+                if ( uv_is_active( (uv_handle_t*) &_sampler ) )
+                        return;
+                auto cb = +[]( uv_timer_t* t ) {
+                        static_cast< proc_ctx* >( t->data )->sample();
+                };
+                uv_timer_start( &_sampler, cb, sample_ms, sample_ms );
+        }
+
+        void sample()
+        {
+                std::size_t n = 0;
+                for ( auto it = procs.begin(); it != procs.end(); ++it ) {
+                        auto& p = *it->second;
+                        // warm tasks have no process of their own
+                        if ( p.state != proc_state::running || p.worker )
+                                continue;
+                        proc_usage u;
+                        if ( sample_proc( p.process.pid, u ) )
+                                p.usage.merge_max( u );
+                        ++n;
+                }
+                if ( n == 0 )
+                        uv_timer_stop( &_sampler );
+        }
+
         void clear_procs( zll::ll_list< proc >& procs )
         {
+                // no child is reaped between the exit callbacks and the tick they scheduled
+                auto [id, u] = reaps.settle();
                 while ( !procs.empty() ) {
                         auto& p = procs.take_front();
                         procs.remove_if( [&]( auto& x ) {
                                 return &x == &p;
                         } );
+                        if ( !p.reaped_status )
+                                continue;
+                        if ( id == p.task_id )
+                                p.usage.merge_max( u );
+                        p.exited( *p.reaped_status );
+                        p.reaped_status.reset();
+                }
+        }
+
+        /// Starts queued tasks while there is room for them
+        void admit()
+        {
+                while ( !_queue.empty() && ( max_running == 0 || running() < max_running ) ) {
+                        uint32_t const task_id = _queue.begin()->second;
+                        _queue.erase( _queue.begin() );
+                        auto it = procs.find( task_id );
+                        if ( it == procs.end() )
+                                continue;
+                        auto& p = *it->second;
+                        spdlog::info( "Starting queued task ID {}", task_id );
+                        // the start was acknowledged already, the failure is its exit
+                        if ( !launch( p ) )
+                                p.on_exit( -1, 0 );
                 }
         }
-};
 
+        // queued task IDs by priority, in order of arrival within one
+        std::multimap< uint32_t, uint32_t, std::greater<> > _queue;
+        uv_timer_t                                          _sampler;
+};
 
-task< void > task_start(
-    auto&              tctx,
-    proc_ctx&          ctx,
-    uint32_t           task_id,
-    char const*        binary,
-    char const*        cwd,
-    std::span< char* > args )
+/// Starts the task described by `spec`, it is queued if `max_running` tasks are running already
+task< void > task_start( auto& tctx, proc_ctx& ctx, uint32_t task_id, task_spec spec )
 {
-        auto [it, inserted] = ctx.procs.try_emplace( task_id, tctx.loop, ctx.finished_procs );
+        auto [it, inserted] = ctx.procs.try_emplace(
+            task_id,
+            task_id,
+            tctx.loop,
+            ctx.finished_procs,
+            ctx,
+            ctx.pool,
+            ctx.killer,
+            ctx.reaps );
         if ( !inserted ) {
                 spdlog::error( "Task with ID {} already exists", task_id );
                 co_yield ecor::with_error{ error::input_error };
         }
-        auto& p = it->second;
-        if ( !p->start( binary, cwd, args.data() ) ) {
+        auto& p             = it->second;
+        p->stream.mem_limit = ctx.output_mem_limit;
+        p->spec             = std::move( spec );
+        if ( ctx.must_queue() ) {
+                spdlog::info( "Task with ID {} queued, {} tasks running", task_id, ctx.running() );
+                ctx.enqueue( *p );
+                co_return;
+        }
+        if ( !ctx.launch( *p ) ) {
                 ctx.procs.erase( it );
                 co_yield ecor::with_error{ error::libuv_error };
         }
         spdlog::debug( "Task with ID {} started", task_id );
 }
 
+/// Cap on output of one progress report and its default budget, the reply has to fit the memory
+/// of a task slot and the receive buffer of the hub
+static constexpr std::size_t max_progress_bytes = 4 * 1024;
+
 struct progress_report
 {
-        proc_stream::evt_var event;
-        std::size_t          events_n = 0;
-};
+        static constexpr std::size_t max_events = 9;
 
+        // in the order they were produced, adjacent output of one stream is merged
+        std::vector< proc_stream::evt_var > events;
+        // events still queued
+        std::size_t events_n = 0;
+        // the task waits for admission, there are no events
+        bool queued = false;
+        // set if the report ends with the exit status
+        std::optional< proc_usage > usage;
+};
 
-task< progress_report > task_progress( auto&, proc_ctx& ctx, uint32_t task_id )
+/// Waits for the first event of the task and takes every following queued event while their
+/// output fits `max_bytes`, or `max_progress_bytes` if it is 0. Of the first event at most that
+/// many bytes are taken, the rest stays queued. The exit status is reported once all output
+/// before it is.
+task< progress_report >
+task_progress( auto&, proc_ctx& ctx, uint32_t task_id, std::size_t max_bytes = 0 )
 {
         auto it = ctx.procs.find( task_id );
         if ( it == ctx.procs.end() ) {
@@ -294,30 +1569,121 @@ task< progress_report > task_progress( auto&, proc_ctx& ctx, uint32_t task_id )
                 co_yield ecor::with_error{ error::input_error };
         }
         async_ptr< proc >& p = it->second;
+        proc_stream&       s = p->stream;
 
         spdlog::debug( "Task with ID {} progress requested", task_id );
 
-        if ( p->stream.exit_status().has_value() ) {
-                co_return progress_report{
-                    .event = proc_stream::exit_evt{ co_await p->stream.exit_status() },
-                };
+        progress_report res;
+        if ( p->state == proc_state::queued ) {
+                res.queued = true;
+                co_return res;
         }
-        auto dq = co_await p->stream.deque();
-        if ( auto* x = std::get_if< proc_stream::stdout_evt >( &dq ) ) {
-                co_return progress_report{
-                    .event = proc_stream::stdout_evt{ std::move( x->mem ) },
-                };
-        } else if ( auto* x = std::get_if< proc_stream::stderr_evt >( &dq ) ) {
-                co_return progress_report{
-                    .event = proc_stream::stderr_evt{ std::move( x->mem ) },
-                };
+        res.events.reserve( progress_report::max_events );
+        // the queue is not empty while spilled output is read back
+        while ( !s.front() && ( s.size() != 0 || !s.exit_status().has_value() ) )
+                co_await s.arrival();
+        if ( !s.front() )
+                res.events.emplace_back( proc_stream::exit_evt{ co_await s.exit_status() } );
+
+        std::size_t const cap =
+            std::min( max_bytes != 0 ? max_bytes : max_progress_bytes, max_progress_bytes );
+
+        std::size_t bytes = 0;
+        while ( res.events.size() < progress_report::max_events &&
+                ( res.events.empty() || !proc_stream::is_exit( res.events.back() ) ) ) {
+                if ( !s.front() )
+                        break;
+                std::size_t const n = s.front_size();
+                if ( !res.events.empty() && n != 0 && bytes + n > cap )
+                        break;
+                auto e = s.try_deque( cap - bytes );
+                if ( !e )
+                        break;
+                bytes += proc_stream::output_size( *e );
+                if ( res.events.empty() || !proc_stream::merge( res.events.back(), *e ) )
+                        res.events.push_back( std::move( *e ) );
         }
-        auto* x = std::get_if< proc_stream::exit_evt >( &dq );
-        if ( !x )
+
+        // the exit event could have been taken by another progress request already
+        if ( !s.front() && s.exit_status().has_value() &&
+             res.events.size() < progress_report::max_events &&
+             ( res.events.empty() || !proc_stream::is_exit( res.events.back() ) ) )
+                res.events.emplace_back( proc_stream::exit_evt{ co_await s.exit_status() } );
+        if ( res.events.empty() )
                 co_yield ecor::with_error{ error::internal_error };
-        co_return progress_report{
-            .event = proc_stream::exit_evt{ x->exit_status },
-        };
+
+        if ( proc_stream::is_exit( res.events.back() ) )
+                res.usage = p->usage;
+        res.events_n = s.size();
+        p->throttle();
+        co_return res;
+}
+
+struct read_report
+{
+        std::span< uint8_t > data;
+        // bytes of the stream logged so far
+        uint64_t stream_size = 0;
+        bool     exited      = false;
+};
+
+/// Reads logged output of the task starting at `offset` of the stream into `buff`, with
+/// positional reads of the log. Reads past the logged output return no data.
+task< read_report > task_read(
+    auto&                tctx,
+    proc_ctx&            ctx,
+    uint32_t             task_id,
+    bool                 is_err,
+    uint64_t             offset,
+    std::span< uint8_t > buff )
+{
+        auto it = ctx.procs.find( task_id );
+        if ( it == ctx.procs.end() ) {
+                spdlog::error( "Task with ID {} not found", task_id );
+                co_yield ecor::with_error{ error::input_error };
+        }
+        // the task can be cancelled while a read is in flight, this keeps it and its log open
+        async_ptr< proc > p   = it->second.share();
+        output_log const& log = p->stream.log();
+
+        std::size_t done = 0;
+        for ( ;; ) {
+                auto piece = log.locate( is_err, offset + done );
+                if ( !log.is_open() || !piece || done == buff.size() )
+                        co_return read_report{
+                            .data        = buff.subspan( 0, done ),
+                            .stream_size = log.stream_size( is_err ),
+                            .exited      = p->stream.exit_status().has_value(),
+                        };
+
+                auto n   = std::min< uint64_t >( piece->second, buff.size() - done );
+                auto got = co_await fs_read{
+                    tctx.loop, log.handle(), piece->first, buff.subspan( done, n ) };
+                done += got.size();
+                if ( got.size() < n )
+                        co_yield ecor::with_error{ error::internal_error };
+        }
+}
+
+/// Adds `credit` to the subscription of the task, the first call subscribes it
+task< void > task_subscribe( auto&, proc_ctx& ctx, uint32_t task_id, uint64_t credit )
+{
+        auto it = ctx.procs.find( task_id );
+        if ( it == ctx.procs.end() ) {
+                spdlog::error( "Task with ID {} not found", task_id );
+                co_yield ecor::with_error{ error::input_error };
+        }
+        if ( !ctx.sink ) {
+                spdlog::error( "No receiver for output of task ID {}", task_id );
+                co_yield ecor::with_error{ error::input_error };
+        }
+        async_ptr< proc >& p = it->second;
+        spdlog::info( "Task ID {} subscribed with credit {}", task_id, credit );
+        p->sink = ctx.sink;
+        p->credit += credit;
+        // queued output is pushed from tick(), after the reply to this request
+        ctx.schedule_tick();
+        co_return;
 }
 
 task< void > task_cancel( auto& tctx, proc_ctx& ctx, uint32_t task_id )
@@ -329,6 +1695,7 @@ task< void > task_cancel( auto& tctx, proc_ctx& ctx, uint32_t task_id )
         }
         async_ptr< proc >& p = it->second;
         spdlog::info( "Cancelling task ID {}", task_id );
+        ctx.dequeue( task_id );
         co_await destroy( tctx, *p );
         ctx.procs.erase( it );
         co_return;
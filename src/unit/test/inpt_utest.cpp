@@ -4,6 +4,7 @@
 #include "../src/util.hpp"
 #include "../unit.hpp"
 
+#include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
@@ -16,6 +17,7 @@
 #include <span>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <variant>
 #include <vector>
 
@@ -32,10 +34,13 @@ enum class message_type
         task_start,
         task_progress,
         task_cancel,
+        task_subscribe,
+        task_read,
         list_folder,
         list_tasks,
         file,
-        task
+        task,
+        batch
 };
 
 struct fields_map
@@ -103,6 +108,8 @@ struct executor_command
                 folder_empty,
                 active_transfers,
                 active_tasks,
+                max_tasks,
+                task_exited,
                 skip
         };
 
@@ -263,10 +270,16 @@ std::optional< message_type > parse_message_type( std::string_view s )
                 return message_type::task_progress;
         if ( s == "task_cancel" )
                 return message_type::task_cancel;
+        if ( s == "task_subscribe" )
+                return message_type::task_subscribe;
+        if ( s == "task_read" )
+                return message_type::task_read;
         if ( s == "list_folder" )
                 return message_type::list_folder;
         if ( s == "list_tasks" )
                 return message_type::list_tasks;
+        if ( s == "batch" )
+                return message_type::batch;
         return std::nullopt;
 }
 
@@ -286,6 +299,10 @@ std::optional< executor_command::kind > parse_executor_kind( std::string_view s
                 return executor_command::kind::active_transfers;
         if ( s == "active_tasks" )
                 return executor_command::kind::active_tasks;
+        if ( s == "max_tasks" )
+                return executor_command::kind::max_tasks;
+        if ( s == "task_exited" )
+                return executor_command::kind::task_exited;
         return std::nullopt;
 }
 
@@ -314,6 +331,11 @@ void autoload_from_file( auto& fields, parser& p )
                         size_t offset = std::stoull( ii->second );
                         contents      = contents.substr( std::min( offset, contents.size() ) );
                 }
+                if ( auto ii = fields.find( "size" ); ii != fields.end() ) {
+                        size_t size = std::stoull( ii->second );
+                        contents.resize( std::min( size, contents.size() ) );
+                        fields.erase( ii );
+                }
                 iter->second = std::move( contents );
         }
 }
@@ -470,6 +492,8 @@ struct inpt_test : public ::testing::Test
         inpt_test( test_case const* test_case_ptr )
           : tc( test_case_ptr )
         {
+                // tasks that ignore SIGTERM are cancelled without slowing the cases down
+                uctx.pctx.killer.grace_ms = 200;
         }
 
         virtual ~inpt_test() noexcept = default;
@@ -588,6 +612,11 @@ private:
         uint8_t                buffer1[1024 * 8], buffer2[1024 * 8];
         char                   filename_buffer[256];
         circular_buffer_memory mem2{ std::span{ buffer2 } };
+        // frames to the unit, allocated from mem2 until written
+        write_gate   gate{ (uv_stream_t*) &server_client };
+        frame_sender tx{ (uv_stream_t*) &server_client, mem2, gate };
+        // encoded messages marked `batched:`, sent together by the next `batch` message
+        std::vector< std::vector< uint8_t > > pending_batch;
 
         hub_to_unit build_message( send_command cmd, circular_buffer_memory& mem )
         {
@@ -614,6 +643,8 @@ private:
 
                         fts.filesize = std::stoull( cmd.fields.take( "filesize" ) );
                         ftr.seq      = std::stoul( cmd.fields.take( "seq" ) );
+                        if ( auto w = cmd.fields.try_take( "window" ) )
+                                fts.window = std::stoul( *w );
 
                         ftr.which_sub         = file_transfer_req_start_tag;
                         ftr.sub.start         = fts;
@@ -730,6 +761,33 @@ private:
                                 }
                         }
 
+                        if ( auto x = cmd.fields.try_take( "warm" ) )
+                                tsr.warm = *x == "true";
+                        if ( auto x = cmd.fields.try_take( "direct" ) )
+                                tsr.direct = *x == "true";
+                        if ( auto x = cmd.fields.try_take( "priority" ) )
+                                tsr.priority = std::stoul( *x );
+                        if ( auto x = cmd.fields.try_take( "cpu_weight" ) )
+                                tsr.cpu_weight = std::stoul( *x );
+                        if ( auto x = cmd.fields.try_take( "env" ) ) {
+                                npb_str** last = &tsr.env;
+
+                                std::istringstream vars( *x );
+                                std::string        var;
+                                while ( std::getline( vars, var, ',' ) ) {
+                                        *last = mem.make< npb_str >( npb_str{
+                                                                         .next = nullptr,
+                                                                     } )
+                                                    .release();
+                                        auto* s =
+                                            (char*) mem.allocate( var.size() + 1, alignof( char ) );
+                                        strcpy( s, var.c_str() );
+                                        ( *last )->str = s;
+
+                                        last = &( *last )->next;
+                                }
+                        }
+
                         tr.which_sub  = task_req_start_tag;
                         tr.sub.start  = tsr;
                         msg.which_sub = hub_to_unit_task_tag;
@@ -741,9 +799,11 @@ private:
                         task_req tr     = task_req_init_default;
                         tr.task_id      = std::stoul( cmd.fields.take( "task_id" ) );
                         tr.which_sub    = task_req_progress_tag;
-                        tr.sub.progress = unit_init_default;
-                        msg.which_sub   = hub_to_unit_task_tag;
-                        msg.sub.task    = tr;
+                        tr.sub.progress = task_progress_req_init_default;
+                        if ( auto x = cmd.fields.try_take( "max_bytes" ) )
+                                tr.sub.progress.max_bytes = std::stoul( *x );
+                        msg.which_sub = hub_to_unit_task_tag;
+                        msg.sub.task  = tr;
                         break;
                 }
 
@@ -757,6 +817,31 @@ private:
                         break;
                 }
 
+                case message_type::task_subscribe: {
+                        task_req tr             = task_req_init_default;
+                        tr.task_id              = std::stoul( cmd.fields.take( "task_id" ) );
+                        tr.which_sub            = task_req_subscribe_tag;
+                        tr.sub.subscribe        = task_subscribe_req_init_default;
+                        tr.sub.subscribe.credit = std::stoull( cmd.fields.take( "credit" ) );
+                        msg.which_sub           = hub_to_unit_task_tag;
+                        msg.sub.task            = tr;
+                        break;
+                }
+
+                case message_type::task_read: {
+                        task_req tr        = task_req_init_default;
+                        tr.task_id         = std::stoul( cmd.fields.take( "task_id" ) );
+                        tr.which_sub       = task_req_read_tag;
+                        tr.sub.read        = task_read_req_init_default;
+                        tr.sub.read.offset = std::stoull( cmd.fields.take( "offset" ) );
+                        tr.sub.read.length = std::stoul( cmd.fields.take( "length" ) );
+                        if ( auto x = cmd.fields.try_take( "serr" ) )
+                                tr.sub.read.serr = *x == "true";
+                        msg.which_sub = hub_to_unit_task_tag;
+                        msg.sub.task  = tr;
+                        break;
+                }
+
                 case message_type::list_tasks: {
                         list_tasks_req ltr = list_tasks_req_init_default;
                         ltr.offset         = std::stoi( cmd.fields.take( "offset" ) );
@@ -764,6 +849,21 @@ private:
                         msg.sub.list_tasks = ltr;
                         break;
                 }
+
+                case message_type::batch: {
+                        npb_data_list** last = &msg.sub.batch.msgs;
+                        *last                = nullptr;
+                        for ( auto& m : pending_batch ) {
+                                npb_data_list e{
+                                    .data = { .data = m.data(), .size = (uint32_t) m.size() },
+                                    .next = nullptr,
+                                };
+                                *last = mem.make< npb_data_list >( e ).release();
+                                last  = &( *last )->next;
+                        }
+                        msg.which_sub = hub_to_unit_batch_tag;
+                        break;
+                }
                 default: {
                         break;
                 }
@@ -774,11 +874,12 @@ private:
                 return msg;
         }
 
-        bool execute_command( send_command const& cmd )
+        bool execute_command( send_command cmd )
         {
                 uint8_t                buffer[1024 * 8];
                 circular_buffer_memory mem{ buffer };
-                hub_to_unit            msg = build_message( cmd, mem );
+                bool                   batched = cmd.fields.try_take( "batched" ).has_value();
+                hub_to_unit            msg     = build_message( cmd, mem );
 
                 npb_ostream_ctx octx{ .buff = std::span{ buffer1 } };
                 pb_ostream_t    stream = npb_ostream_from( octx );
@@ -788,13 +889,19 @@ private:
                         EXPECT_TRUE( result )
                             << "Failed to encode message: " << PB_GET_ERROR( &stream );
 
+                if ( batched ) {
+                        pending_batch.emplace_back( buffer1, buffer1 + stream.bytes_written );
+                        return true;
+                }
+                if ( msg.which_sub == hub_to_unit_batch_tag )
+                        pending_batch.clear();
+
                 spdlog::info(
                     "Sending message {} of size {}: {}",
                     cmd.req_id,
                     stream.bytes_written,
                     std::vector< int >{ buffer1, buffer1 + stream.bytes_written } );
-                auto status = cobs_send(
-                    mem2, &server_client, { std::data( buffer1 ), stream.bytes_written } );
+                auto status = tx.send( { std::data( buffer1 ), stream.bytes_written } );
                 EXPECT_EQ( send_status::SUCCESS, status ) << "Failed to send message";
                 return true;
         }
@@ -910,6 +1017,20 @@ private:
                 case message_type::file_transfer_end:
                         EXPECT_EQ( unit_to_hub_file_tag, msg.which_sub );
                         verify_field( cmd.fields, "success", msg.sub.file.success );
+                        verify_field( cmd.fields, "window", msg.sub.file.window );
+                        verify_field( cmd.fields, "acked", msg.sub.file.acked );
+                        {
+                                // comma-separated list of offset+size
+                                std::string gaps_str;
+                                for ( pb_size_t i = 0; i < msg.sub.file.gaps_count; ++i ) {
+                                        if ( !gaps_str.empty() )
+                                                gaps_str += ",";
+                                        gaps_str += std::to_string( msg.sub.file.gaps[i].offset ) +
+                                                    "+" +
+                                                    std::to_string( msg.sub.file.gaps[i].size );
+                                }
+                                verify_field( cmd.fields, "gaps", gaps_str );
+                        }
                         break;
 
                 case message_type::folder_ctl:
@@ -937,6 +1058,7 @@ private:
                 case message_type::task:
                 case message_type::task_start:
                 case message_type::task_cancel:
+                case message_type::task_subscribe:
                         EXPECT_EQ( unit_to_hub_task_tag, msg.which_sub );
                         verify_field( cmd.fields, "task_id", msg.sub.task.task_id );
                         if ( msg.sub.task.which_sub == task_resp_success_tag )
@@ -962,10 +1084,62 @@ private:
                                     cmd.fields,
                                     "exit_status",
                                     msg.sub.task.sub.progress.sub.exit_status );
+                        } else if ( msg.sub.task.sub.progress.queued ) {
+                                verify_field( cmd.fields, "queued", true );
                         } else {
                                 EXPECT_TRUE( false );
                                 return false;
                         }
+                        verify_field(
+                            cmd.fields, "events_left", msg.sub.task.sub.progress.events_left );
+                        if ( auto x = cmd.fields.try_take( "usage" ) ) {
+                                auto& pr = msg.sub.task.sub.progress;
+                                EXPECT_EQ( *x == "true", pr.has_usage );
+                                // a task that exited ran for some time
+                                if ( pr.has_usage )
+                                        EXPECT_GT( pr.usage.wall_us, 0u );
+                        }
+                        // whether the task was charged CPU time and memory
+                        if ( auto x = cmd.fields.try_take( "cpu" ) ) {
+                                auto& u = msg.sub.task.sub.progress.usage;
+                                EXPECT_EQ( *x == "true", u.user_us + u.sys_us > 0 );
+                        }
+                        if ( auto x = cmd.fields.try_take( "rss" ) ) {
+                                auto& u = msg.sub.task.sub.progress.usage;
+                                EXPECT_EQ( *x == "true", u.max_rss_kb > 0 );
+                        }
+                        {
+                                // comma-separated kinds of the following events, exit=N for exit
+                                auto&       pr = msg.sub.task.sub.progress;
+                                std::string more_str;
+                                for ( pb_size_t i = 0; i < pr.more_count; ++i ) {
+                                        if ( !more_str.empty() )
+                                                more_str += ",";
+                                        auto const& m = pr.more[i];
+                                        if ( m.which_sub == task_output_sout_tag )
+                                                more_str += "sout";
+                                        else if ( m.which_sub == task_output_serr_tag )
+                                                more_str += "serr";
+                                        else
+                                                more_str += "exit=" +
+                                                            std::to_string( m.sub.exit_status );
+                                }
+                                verify_field( cmd.fields, "more", more_str );
+                        }
+                        break;
+                }
+                case message_type::task_read: {
+                        EXPECT_EQ( unit_to_hub_task_tag, msg.which_sub );
+                        verify_field( cmd.fields, "task_id", msg.sub.task.task_id );
+                        if ( msg.sub.task.which_sub == task_resp_success_tag ) {
+                                verify_field( cmd.fields, "success", msg.sub.task.sub.success );
+                                break;
+                        }
+                        EXPECT_EQ( task_resp_read_tag, msg.sub.task.which_sub );
+                        auto& rd = msg.sub.task.sub.read;
+                        verify_field( cmd.fields, "data", rd.data );
+                        verify_field( cmd.fields, "size", rd.size );
+                        verify_field( cmd.fields, "exited", rd.exited );
                         break;
                 }
                 case message_type::list_tasks: {
@@ -978,6 +1152,24 @@ private:
                                 tasks_str += std::to_string( msg.sub.list_tasks.tasks[i] );
                         }
                         verify_field( cmd.fields, "tasks", tasks_str );
+                        std::string queued_str;
+                        for ( size_t i = 0; i < msg.sub.list_tasks.queued_count; ++i ) {
+                                if ( !queued_str.empty() )
+                                        queued_str += ",";
+                                queued_str += std::to_string( msg.sub.list_tasks.queued[i] );
+                        }
+                        verify_field( cmd.fields, "queued", queued_str );
+                        break;
+                }
+                case message_type::batch: {
+                        EXPECT_EQ( unit_to_hub_batch_tag, msg.which_sub );
+                        // replies of the batch are verified by the following commands, in order
+                        std::vector< std::vector< uint8_t > > entries;
+                        for ( npb_data_list* e = msg.sub.batch.msgs; e != nullptr; e = e->next )
+                                entries.emplace_back( e->data.data, e->data.data + e->data.size );
+                        verify_field( cmd.fields, "count", (uint64_t) entries.size() );
+                        received_messages.insert(
+                            received_messages.begin(), entries.begin(), entries.end() );
                         break;
                 }
                 }
@@ -1010,6 +1202,18 @@ private:
                 throw std::runtime_error( "missing 'count' field" );
         }
 
+        /// The task exited and all of its output was read, a dropped task counts as exited
+        bool task_exited( uint32_t task_id )
+        {
+                auto it = uctx.pctx.procs.find( task_id );
+                if ( it == uctx.pctx.procs.end() )
+                        return true;
+                proc& p = *it->second;
+                return p.state == proc_state::exited &&
+                       uv_is_closing( (uv_handle_t*) &p.stdout_pipe ) &&
+                       uv_is_closing( (uv_handle_t*) &p.stderr_pipe );
+        }
+
         bool execute_command( executor_command cmd )
         {
                 for ( std::size_t i = 0; i < 100; ++i )
@@ -1090,6 +1294,27 @@ private:
                         EXPECT_EQ( expected_count, actual_count ) << "Active tasks count mismatch";
                         break;
                 }
+                case executor_command::kind::max_tasks: {
+                        uctx.pctx.max_running = get_count( cmd );
+                        break;
+                }
+                case executor_command::kind::task_exited: {
+                        auto const id = cmd.fields.try_take( "task_id" );
+                        if ( !id ) {
+                                ADD_FAILURE() << "task_exited: missing 'task_id' field";
+                                break;
+                        }
+                        uint32_t const task_id  = std::stoul( *id );
+                        auto const     deadline = std::chrono::steady_clock::now() +
+                                              std::chrono::seconds( 10 );
+                        while ( !task_exited( task_id ) &&
+                                std::chrono::steady_clock::now() < deadline ) {
+                                uv_run( ctx.loop, UV_RUN_NOWAIT );
+                                std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+                        }
+                        EXPECT_TRUE( task_exited( task_id ) ) << "Task did not exit: " << task_id;
+                        break;
+                }
                 }
                 cmd.fields.finalize();
                 return true;
@@ -0,0 +1,58 @@
+#include "../output_log.hpp"
+
+#include <cstdlib>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <string>
+#include <string_view>
+
+namespace trctl
+{
+
+std::span< uint8_t const > bytes_of( std::string_view s )
+{
+        return { (uint8_t const*) s.data(), s.size() };
+}
+
+TEST( output_log, locates_streams )
+{
+        auto path = ( std::filesystem::temp_directory_path() / "trctl_output_log.out" ).string();
+        {
+                output_log log;
+                ASSERT_TRUE( log.open( uv_default_loop(), path ) );
+                EXPECT_EQ( log.append( false, bytes_of( "abc" ) ), 0u );
+                EXPECT_EQ( log.append( false, bytes_of( "de" ) ), 3u );
+                EXPECT_EQ( log.append( true, bytes_of( "XY" ) ), 5u );
+                EXPECT_EQ( log.append( false, bytes_of( "fg" ) ), 7u );
+                EXPECT_EQ( log.stream_size( false ), 7u );
+                EXPECT_EQ( log.stream_size( true ), 2u );
+                // nothing can be read before it was written
+                EXPECT_FALSE( log.locate( false, 0 ) );
+                EXPECT_EQ( log.pending(), 9u );
+                uv_run( uv_default_loop(), UV_RUN_DEFAULT );
+                EXPECT_EQ( log.written(), 9u );
+                EXPECT_EQ( log.pending(), 0u );
+
+                // stdout is stored in two runs, the first one merged from two appends
+                using piece = std::pair< uint64_t, uint64_t >;
+                EXPECT_EQ( log.locate( false, 0 ), ( piece{ 0, 5 } ) );
+                EXPECT_EQ( log.locate( false, 4 ), ( piece{ 4, 1 } ) );
+                EXPECT_EQ( log.locate( false, 5 ), ( piece{ 7, 2 } ) );
+                EXPECT_EQ( log.locate( true, 1 ), ( piece{ 6, 1 } ) );
+                EXPECT_FALSE( log.locate( false, 7 ) );
+                EXPECT_FALSE( log.locate( true, 2 ) );
+
+                std::string read;
+                EXPECT_FALSE( log.read_back( 6, 4, []( uint8_t*, std::size_t ) {} ) );
+                EXPECT_TRUE( log.read_back( 3, 4, [&]( uint8_t* m, std::size_t n ) {
+                        read.assign( (char const*) m, n );
+                        free( m );
+                } ) );
+                uv_run( uv_default_loop(), UV_RUN_DEFAULT );
+                EXPECT_EQ( read, "deXY" );
+        }
+        uv_run( uv_default_loop(), UV_RUN_DEFAULT );
+        EXPECT_FALSE( std::filesystem::exists( path ) );
+}
+
+}  // namespace trctl
@@ -0,0 +1,121 @@
+#include "../process.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <string>
+#include <string_view>
+
+namespace trctl
+{
+
+template < typename E >
+E output_evt( std::string_view s )
+{
+        auto* p = (uint8_t*) malloc( s.size() );
+        std::memcpy( p, s.data(), s.size() );
+        return E{ mem_buff{ p, s.size() } };
+}
+
+std::string_view text_of( proc_stream::evt_var const& e )
+{
+        if ( auto* x = std::get_if< proc_stream::stdout_evt >( &e ) )
+                return { (char const*) x->mem.mem, x->mem.size };
+        if ( auto* x = std::get_if< proc_stream::stderr_evt >( &e ) )
+                return { (char const*) x->mem.mem, x->mem.size };
+        return {};
+}
+
+/// Runs the loop until the writes and reads of the log finished
+void settle()
+{
+        uv_run( uv_default_loop(), UV_RUN_DEFAULT );
+}
+
+TEST( proc_stream, spills_over_mem_limit )
+{
+        auto path = ( std::filesystem::temp_directory_path() / "trctl_spill.out" ).string();
+        {
+                proc_stream s;
+                s.mem_limit = 8;
+                ASSERT_TRUE( s.open_log( uv_default_loop(), path ) );
+
+                s.enque( output_evt< proc_stream::stdout_evt >( "aaaaaa" ) );
+                s.enque( output_evt< proc_stream::stdout_evt >( "bbbbbb" ) );
+                s.enque( output_evt< proc_stream::stdout_evt >( "cc" ) );
+                s.enque( output_evt< proc_stream::stderr_evt >( "ddd" ) );
+                s.enque( proc_stream::exit_evt{ 0 } );
+                EXPECT_EQ( s.mem_bytes(), 6u );
+                EXPECT_TRUE( std::filesystem::exists( path ) );
+                // the spilled output is one entry of the queue
+                EXPECT_EQ( s.size(), 3u );
+
+                auto e = s.try_deque();
+                ASSERT_TRUE( e );
+                EXPECT_EQ( text_of( *e ), "aaaaaa" );
+                EXPECT_EQ( s.mem_bytes(), 0u );
+
+                // spilled output is taken once it was written and read back
+                EXPECT_FALSE( s.front() );
+                settle();
+                EXPECT_EQ( s.front_size(), 8u );
+                e = s.try_deque();
+                ASSERT_TRUE( e );
+                EXPECT_TRUE( std::holds_alternative< proc_stream::stdout_evt >( *e ) );
+                EXPECT_EQ( text_of( *e ), "bbbbbbcc" );
+
+                settle();
+                e = s.try_deque();
+                ASSERT_TRUE( e );
+                EXPECT_TRUE( std::holds_alternative< proc_stream::stderr_evt >( *e ) );
+                EXPECT_EQ( text_of( *e ), "ddd" );
+
+                e = s.try_deque();
+                ASSERT_TRUE( e );
+                EXPECT_TRUE( proc_stream::is_exit( *e ) );
+                EXPECT_FALSE( s.try_deque() );
+
+                // output is held in memory again once the spilled one is read back
+                s.enque( output_evt< proc_stream::stdout_evt >( "ee" ) );
+                EXPECT_EQ( s.mem_bytes(), 2u );
+        }
+        settle();
+        EXPECT_FALSE( std::filesystem::exists( path ) );
+}
+
+TEST( proc_stream, reads_spill_in_chunks )
+{
+        auto path = ( std::filesystem::temp_directory_path() / "trctl_spill_chunks.out" ).string();
+
+        proc_stream s;
+        s.mem_limit = 1;
+        ASSERT_TRUE( s.open_log( uv_default_loop(), path ) );
+
+        std::string big( proc_stream::spill_chunk + 10, 'x' );
+        s.enque( output_evt< proc_stream::stdout_evt >( "a" ) );
+        s.enque( output_evt< proc_stream::stdout_evt >( big ) );
+        EXPECT_EQ( s.mem_bytes(), 1u );
+
+        EXPECT_EQ( text_of( *s.try_deque() ), "a" );
+        settle();
+        EXPECT_EQ( s.front_size(), proc_stream::spill_chunk );
+        EXPECT_EQ( text_of( *s.try_deque() ).size(), proc_stream::spill_chunk );
+        settle();
+        EXPECT_EQ( s.front_size(), 10u );
+        EXPECT_EQ( text_of( *s.try_deque() ).size(), 10u );
+        EXPECT_EQ( s.size(), 0u );
+}
+
+TEST( proc_stream, full_without_log )
+{
+        proc_stream s;
+        s.mem_limit = 4;
+        s.enque( output_evt< proc_stream::stdout_evt >( "abc" ) );
+        EXPECT_FALSE( s.full() );
+        s.enque( output_evt< proc_stream::stdout_evt >( "de" ) );
+        EXPECT_TRUE( s.full() );
+        EXPECT_EQ( text_of( *s.try_deque() ), "abc" );
+        EXPECT_FALSE( s.full() );
+}
+
+}  // namespace trctl
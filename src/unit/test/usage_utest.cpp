@@ -0,0 +1,92 @@
+#include "../usage.hpp"
+
+#include <gtest/gtest.h>
+#include <sys/wait.h>
+
+namespace trctl
+{
+
+TEST( usage, samples_live_process )
+{
+        proc_usage u;
+        ASSERT_TRUE( sample_proc( getpid(), u ) );
+        EXPECT_GT( u.max_rss_kb, 0u );
+
+        EXPECT_FALSE( sample_proc( -1, u ) );
+}
+
+TEST( usage, accounts_reaped_children )
+{
+        reaped_since_last();
+
+        pid_t pid = fork();
+        ASSERT_GE( pid, 0 );
+        if ( pid == 0 ) {
+                // burn some CPU so that the child is visible in the usage
+                volatile uint64_t x = 0;
+                for ( uint64_t i = 0; i < 200'000'000; ++i )
+                        x = x + i;
+                _exit( 0 );
+        }
+        int status = 0;
+        ASSERT_EQ( waitpid( pid, &status, 0 ), pid );
+
+        auto u = reaped_since_last();
+        EXPECT_GT( u.user_us + u.sys_us, 0u );
+        EXPECT_EQ( reaped_since_last().user_us, 0u );
+}
+
+// child that burns some CPU, reaped by the caller
+static pid_t spawn_busy()
+{
+        pid_t pid = fork();
+        if ( pid == 0 ) {
+                volatile uint64_t x = 0;
+                for ( uint64_t i = 0; i < 100'000'000; ++i )
+                        x = x + i;
+                _exit( 0 );
+        }
+        return pid;
+}
+
+TEST( usage, ledger_charges_single_task )
+{
+        reap_ledger l;
+        l.settle();
+
+        pid_t pid = spawn_busy();
+        ASSERT_GE( pid, 0 );
+        ASSERT_EQ( waitpid( pid, nullptr, 0 ), pid );
+        l.reaped_task( 7 );
+
+        auto [id, u] = l.settle();
+        EXPECT_EQ( id, 7u );
+        EXPECT_GT( u.user_us + u.sys_us, 0u );
+        EXPECT_FALSE( l.settle().first.has_value() );
+}
+
+TEST( usage, ledger_does_not_split_usage )
+{
+        reap_ledger l;
+        l.settle();
+
+        pid_t a = spawn_busy();
+        pid_t b = spawn_busy();
+        ASSERT_GE( a, 0 );
+        ASSERT_GE( b, 0 );
+        ASSERT_EQ( waitpid( a, nullptr, 0 ), a );
+        ASSERT_EQ( waitpid( b, nullptr, 0 ), b );
+        l.reaped_task( 1 );
+        l.reaped_task( 2 );
+        EXPECT_FALSE( l.settle().first.has_value() );
+
+        pid_t c = spawn_busy();
+        ASSERT_GE( c, 0 );
+        ASSERT_EQ( waitpid( c, nullptr, 0 ), c );
+        l.reaped_task( 3 );
+        // a shell reaped along with the task
+        l.reaped_other();
+        EXPECT_FALSE( l.settle().first.has_value() );
+}
+
+}  // namespace trctl
@@ -9,12 +9,13 @@
 
 #include <filesystem>
 #include <list>
+#include <memory>
 
 namespace trctl
 {
 
 
-struct unit_ctx : comp_buff, task_ctx
+struct unit_ctx : comp_buff, task_ctx, output_sink
 {
         uv_loop_t*                loop;
         std::filesystem::path&    workdir;
@@ -28,10 +29,35 @@ struct unit_ctx : comp_buff, task_ctx
                 comps.link_back( pctx );
                 comps.link_back( slots );
                 comps.link_back( fctx );
+                pctx.sink = this;
+        }
+
+        /// Sends an event of a subscribed task to the hub
+        void push( uint32_t task_id, proc_stream::evt_var& evt ) override;
+
+        /// Pushing stops while writes to the hub pile up and resumes once they drain
+        bool writable() override
+        {
+                if ( !cl.gate.blocked() )
+                        return true;
+                cl.gate.wait( pump_resumer );
+                return false;
         }
 
         task< void > shutdown()
         {
+                auto& st = cl.gate.get_stats();
+                spdlog::info(
+                    "Writes to hub blocked {} times for {} ms, at most {} bytes queued",
+                    st.blocked,
+                    st.blocked_ns / 1'000'000,
+                    st.max_queued );
+                auto& tx = cl.tx.get_stats();
+                spdlog::info(
+                    "Sent {} frames to hub, {} directly, rest in {} writes",
+                    tx.frames,
+                    tx.direct,
+                    tx.writes );
                 uv_close( (uv_handle_t*) &cl.tcp, nullptr );
                 co_await slots.shutdown();
                 co_await pctx.shutdown();
@@ -45,9 +71,45 @@ struct unit_ctx : comp_buff, task_ctx
         uint32_t          pctx_buffer[1024 * 8];
         proc_ctx          pctx{ loop, core };
 
-        task_slots< 1024 * 8, 1024 * 16 > slots{ loop, core };
+        // requests are decoded into the memory of their slot, transfer chunks are the largest
+        static constexpr std::size_t slot_mem_size = 1024 * 64;
+        static_assert( max_transfer_chunk + 1024 <= slot_mem_size );
+
+        task_slots< 1024 * 8, slot_mem_size > slots{ loop, core };
+
+        struct _pump_resumer : write_waiter
+        {
+                component&  owner;
+                write_gate& gate;
+
+                _pump_resumer( component& c, write_gate& g )
+                  : owner( c )
+                  , gate( g )
+                {
+                }
+
+                _pump_resumer( _pump_resumer const& )            = delete;
+                _pump_resumer& operator=( _pump_resumer const& ) = delete;
+
+                // destroyed before the owner, the gate must not resume it afterwards
+                ~_pump_resumer()
+                {
+                        gate.cancel( *this );
+                }
+
+                void on_writable() override
+                {
+                        owner.schedule_tick();
+                }
+        };
+
+        // pumps output of subscribed tasks again once the connection drains
+        _pump_resumer pump_resumer{ pctx, cl.gate };
 };
 
+// room of a progress reply besides the output: timestamp, ids, headers of all events and usage
+static constexpr std::size_t max_progress_overhead = 512;
+static_assert( max_progress_bytes + max_progress_overhead <= max_unit_message );
 
 inline unit_to_hub prepare_reply( uv_loop_t* loop, uint64_t req_id )
 {
@@ -60,6 +122,46 @@ inline unit_to_hub prepare_reply( uv_loop_t* loop, uint64_t req_id )
         return msg;
 }
 
+/// Stores `evt` in `res`, a task_progress_resp or task_output, `data` maps output to the message
+inline void store_event( auto& res, proc_stream::evt_var& evt, auto&& data )
+{
+        static_assert(
+            task_output_sout_tag == task_progress_resp_sout_tag &&
+            task_output_serr_tag == task_progress_resp_serr_tag &&
+            task_output_exit_status_tag == task_progress_resp_exit_status_tag );
+        if ( auto* x = std::get_if< proc_stream::exit_evt >( &evt ) ) {
+                res.which_sub       = task_progress_resp_exit_status_tag;
+                res.sub.exit_status = x->exit_status;
+        } else if ( auto* x = std::get_if< proc_stream::stdout_evt >( &evt ) ) {
+                res.which_sub = task_progress_resp_sout_tag;
+                res.sub.sout  = data( x->mem );
+        } else if ( auto* x = std::get_if< proc_stream::stderr_evt >( &evt ) ) {
+                res.which_sub = task_progress_resp_serr_tag;
+                res.sub.serr  = data( x->mem );
+        }
+}
+
+/// Progress report of `evt`, `data` maps output to the message
+inline task_progress_resp progress_of( proc_stream::evt_var& evt, auto&& data )
+{
+        task_progress_resp res = {};
+        store_event( res, evt, data );
+        return res;
+}
+
+/// Wire form of the resources used by a task
+inline task_usage usage_of( proc_usage const& u )
+{
+        return {
+            .wall_us     = u.wall_us,
+            .user_us     = u.user_us,
+            .sys_us      = u.sys_us,
+            .max_rss_kb  = u.max_rss_kb,
+            .read_bytes  = u.read_bytes,
+            .write_bytes = u.write_bytes,
+        };
+}
+
 inline task< unit_to_hub > on_msg(
     task_ctx&               ctx,
     circular_buffer_memory& mem,
@@ -117,11 +219,16 @@ inline task< unit_to_hub > on_msg(
                                         ftr.seq,
                                         sp.data(),
                                         sub.filesize,
+                                        sub.window,
                                         iter->second->deps ) |
                                     ecor::sink_err );
                                 if ( opt_err )
-                                        spdlog::error( "Error during start transfer" );
+                                        spdlog::error(
+                                            "Error during start transfer: {}",
+                                            str( unify( *opt_err ) ) );
                                 reply.sub.file = file_resp{ .success = !opt_err };
+                                if ( !opt_err )
+                                        transfer_ack( fctx, ftr.seq, reply.sub.file );
                         }
                         break;
                 }
@@ -140,6 +247,7 @@ inline task< unit_to_hub > on_msg(
                         reply           = prepare_reply( ctx.loop, msg.req_id );
                         reply.which_sub = unit_to_hub_file_tag;
                         reply.sub.file  = file_resp{ .success = !opt_err };
+                        transfer_ack( fctx, ftr.seq, reply.sub.file );
                         break;
                 }
                 case file_transfer_req_end_tag: {
@@ -173,31 +281,25 @@ inline task< unit_to_hub > on_msg(
                         res.task_id   = treq.task_id;
                         res.which_sub = task_resp_success_tag;
 
-                        std::array< char*, 32 > args;
-                        std::size_t             i = 0;
-                        args[i++]                 = (char*) "--login";
-                        args[i++]                 = (char*) "-c";
-                        args[i++]                 = (char*) "exec \"$@\"";
-                        args[i++]                 = (char*) "--";
-                        for ( npb_str* p = sub.args; p != nullptr && i < args.size() - 1;
-                              p          = p->next ) {
-                                // XXX: dropping const qualifier, fix in near future
-                                args[i++] = (char*) p->str;
-                        }
-                        args[i] = nullptr;
-                        if ( i == args.size() - 1 ) {
-                                spdlog::error( "Too many args for task execution" );
-                                res.sub.success = false;
+                        task_spec spec;
+                        spec.cwd        = std::format( "{}/{}", fctx.workdir.string(), sub.folder );
+                        spec.warm       = sub.warm;
+                        spec.priority   = sub.priority;
+                        spec.cpu_weight = sub.cpu_weight;
+                        // warm shells and direct exec take the arguments without a login shell
+                        if ( !sub.warm && !sub.direct ) {
+                                spec.binary = "/bin/bash";
+                                spec.args   = { "--login", "-c", "exec \"$@\"", "--" };
                         }
-
-                        static constexpr std::size_t n = 128;
-
-                        auto sp = mem.make_span< char >( n );
-                        std::snprintf(
-                            sp.data(), n, "%s/%s", fctx.workdir.string().c_str(), sub.folder );
+                        for ( npb_str* p = sub.args; p != nullptr; p = p->next )
+                                spec.args.emplace_back( p->str );
+                        if ( sub.direct && !spec.args.empty() )
+                                spec.binary = spec.args.front();
+                        for ( npb_str* p = sub.env; p != nullptr; p = p->next )
+                                spec.env.emplace_back( p->str );
 
                         auto opt_err = co_await (
-                            task_start( ctx, pctx, treq.task_id, "/bin/bash", sp.data(), args ) |
+                            task_start( ctx, pctx, treq.task_id, std::move( spec ) ) |
                             ecor::sink_err );
                         res.sub.success = !opt_err;
 
@@ -212,31 +314,47 @@ inline task< unit_to_hub > on_msg(
                         task_resp res;
                         res.task_id = treq.task_id;
 
+                        std::size_t const max_bytes = std::min< std::size_t >(
+                            treq.sub.progress.max_bytes, max_progress_bytes );
+
                         // XXX: error handling
                         auto r = co_await (
-                            task_progress( ctx, pctx, treq.task_id ) | ecor::err_to_val |
-                            ecor::as_variant );
+                            task_progress( ctx, pctx, treq.task_id, max_bytes ) |
+                            ecor::err_to_val | ecor::as_variant );
                         if ( auto* progress = std::get_if< progress_report >( &r ) ) {
-                                res.which_sub    = task_resp_progress_tag;
-                                res.sub.progress = task_progress_resp{};
-
-                                auto& evt = progress->event;
-                                if ( auto* x = std::get_if< proc_stream::exit_evt >( &evt ) ) {
-                                        res.sub.progress.which_sub =
-                                            task_progress_resp_exit_status_tag;
-                                        res.sub.progress.sub.exit_status = x->exit_status;
-                                } else if (
-                                    auto* x = std::get_if< proc_stream::stdout_evt >( &evt ) ) {
-                                        res.sub.progress.which_sub = task_progress_resp_sout_tag;
-                                        auto& s                    = res.sub.progress.sub.sout;
-                                        s                          = copy( mem, x->mem );
-                                } else if (
-                                    auto* x = std::get_if< proc_stream::stderr_evt >( &evt ) ) {
-                                        res.sub.progress.which_sub = task_progress_resp_serr_tag;
-                                        auto& s                    = res.sub.progress.sub.serr;
-                                        s                          = copy( mem, x->mem );
+                                static_assert(
+                                    progress_report::max_events ==
+                                    1 + std::extent_v< decltype( task_progress_resp::more ) > );
+                                // the events are freed before the reply gets encoded
+                                bool copy_failed = false;
+                                auto cp          = [&]( mem_buff& b ) {
+                                        npb_data d = copy( mem, b );
+                                        copy_failed |= d.data == nullptr && b.size != 0;
+                                        return d;
+                                };
+                                auto& events = progress->events;
+                                auto& pr     = res.sub.progress;
+
+                                res.which_sub = task_resp_progress_tag;
+                                if ( progress->queued ) {
+                                        pr        = {};
+                                        pr.queued = true;
+                                } else {
+                                        pr             = progress_of( events.front(), cp );
+                                        pr.more_count  = events.size() - 1;
+                                        pr.events_left = progress->events_n;
+                                        for ( std::size_t i = 1; i < events.size(); ++i )
+                                                store_event( pr.more[i - 1], events[i], cp );
+                                        if ( progress->usage ) {
+                                                pr.has_usage = true;
+                                                pr.usage     = usage_of( *progress->usage );
+                                        }
+                                }
+                                if ( copy_failed ) {
+                                        spdlog::error( "Memory allocation failed for progress" );
+                                        res.which_sub   = task_resp_success_tag;
+                                        res.sub.success = false;
                                 }
-                                res.sub.progress.events_left = progress->events_n;
                         } else {
                                 spdlog::error( "Failed to get task progress" );
                                 res.which_sub   = task_resp_success_tag;
@@ -244,10 +362,70 @@ inline task< unit_to_hub > on_msg(
                         }
 
                         spdlog::info(
-                            "Reporting {} events left for task ID {} with subkind {}",
+                            "Reporting {} events left for task ID {} with subkind {} and {} more",
                             res.sub.progress.events_left,
                             treq.task_id,
-                            res.sub.progress.which_sub );
+                            res.sub.progress.which_sub,
+                            res.sub.progress.more_count );
+                        reply           = prepare_reply( ctx.loop, msg.req_id );
+                        reply.which_sub = unit_to_hub_task_tag;
+                        reply.sub.task  = res;
+                        break;
+                }
+                case task_req_subscribe_tag: {
+                        spdlog::info( "Subscribe request for task ID {}", treq.task_id );
+
+                        task_resp res;
+                        res.task_id   = treq.task_id;
+                        res.which_sub = task_resp_success_tag;
+
+                        auto opt_err = co_await (
+                            task_subscribe( ctx, pctx, treq.task_id, treq.sub.subscribe.credit ) |
+                            ecor::sink_err );
+                        res.sub.success = !opt_err;
+
+                        reply           = prepare_reply( ctx.loop, msg.req_id );
+                        reply.which_sub = unit_to_hub_task_tag;
+                        reply.sub.task  = res;
+                        break;
+                }
+                case task_req_read_tag: {
+                        auto& sub = treq.sub.read;
+                        spdlog::info(
+                            "Read request for task ID {}: {} bytes at {}",
+                            treq.task_id,
+                            sub.length,
+                            sub.offset );
+
+                        task_resp res;
+                        res.task_id     = treq.task_id;
+                        res.which_sub   = task_resp_success_tag;
+                        res.sub.success = false;
+
+                        std::size_t const n =
+                            std::min< std::size_t >( sub.length, max_progress_bytes );
+                        auto* p = (uint8_t*) mem.allocate( std::max< std::size_t >( n, 1 ), 1 );
+                        if ( p == nullptr ) {
+                                spdlog::error( "Memory allocation failed for read of {} bytes", n );
+                        } else {
+                                auto r = co_await (
+                                    task_read(
+                                        ctx, pctx, treq.task_id, sub.serr, sub.offset, { p, n } ) |
+                                    ecor::err_to_val | ecor::as_variant );
+                                if ( auto* rd = std::get_if< read_report >( &r ) ) {
+                                        res.which_sub       = task_resp_read_tag;
+                                        res.sub.read        = task_read_resp_init_default;
+                                        res.sub.read.data   = {
+                                            .data = rd->data.data(),
+                                            .size = (uint32_t) rd->data.size(),
+                                        };
+                                        res.sub.read.size   = rd->stream_size;
+                                        res.sub.read.exited = rd->exited;
+                                } else {
+                                        spdlog::error( "Failed to read output of task" );
+                                }
+                        }
+
                         reply           = prepare_reply( ctx.loop, msg.req_id );
                         reply.which_sub = unit_to_hub_task_tag;
                         reply.sub.task  = res;
@@ -354,6 +532,9 @@ inline task< unit_to_hub > on_msg(
 
                 auto used       = co_await task_list( ctx, pctx, sub.offset, res.tasks );
                 res.tasks_count = used.size();
+                for ( uint32_t id : used )
+                        if ( pctx.is_queued( id ) )
+                                res.queued[res.queued_count++] = id;
 
                 reply                = prepare_reply( ctx.loop, msg.req_id );
                 reply.which_sub      = unit_to_hub_list_tasks_tag;
@@ -364,9 +545,220 @@ inline task< unit_to_hub > on_msg(
         co_return reply;
 }
 
-inline task< void >
-on_raw_msg( task_ctx& ctx, client::promise p, std::span< uint8_t > buffer, auto f )
+/// Replies of the requests of one batch, each stored at the index of its request. A reply stays
+/// in the frame and memory of the task that handled the request until the batch reply is sent, so
+/// that it is encoded straight into the outgoing frame.
+struct batch_join
 {
+        std::span< npb_data_list > replies;
+        std::size_t                pending = 0;
+        // set once the batch reply was sent or abandoned, `replies` is not touched afterwards
+        bool                                          released = false;
+        ecor::broadcast_source< ecor::set_value_t() > done;
+        ecor::broadcast_source< ecor::set_value_t() > sent;
+
+        /// Stores `reply` of request `i`, nullptr marks a failed request
+        void complete( std::size_t i, unit_to_hub const* reply )
+        {
+                if ( !released && reply ) {
+                        replies[i].fields = unit_to_hub_fields;
+                        replies[i].msg    = reply;
+                }
+                if ( --pending == 0 )
+                        done.set_value();
+        }
+
+        /// Marks request `i` as failed again, its reply is gone before the batch reply was sent
+        void withdraw( std::size_t i )
+        {
+                if ( !released )
+                        replies[i].msg = nullptr;
+        }
+
+        void release()
+        {
+                if ( std::exchange( released, true ) )
+                        return;
+                sent.set_value();
+        }
+};
+
+inline void unit_ctx::push( uint32_t task_id, proc_stream::evt_var& evt )
+{
+        unit_to_hub msg           = prepare_reply( loop, 0 );
+        msg.which_sub             = unit_to_hub_task_tag;
+        msg.sub.task.task_id      = task_id;
+        msg.sub.task.which_sub    = task_resp_progress_tag;
+        msg.sub.task.sub.progress = progress_of( evt, []( mem_buff& b ) {
+                return npb_data{ .data = b.mem, .size = (uint32_t) b.size };
+        } );
+        if ( auto it = pctx.procs.find( task_id );
+             proc_stream::is_exit( evt ) && it != pctx.procs.end() ) {
+                msg.sub.task.sub.progress.has_usage = true;
+                msg.sub.task.sub.progress.usage     = usage_of( it->second->usage );
+        }
+
+        if ( npb_send( cl.tx, unit_to_hub_fields, &msg ) != send_status::SUCCESS )
+                spdlog::error( "Failed to push output of task ID {}", task_id );
+}
+
+/// Lowers the output a progress or read request may return to `n` bytes
+inline void limit_output( hub_to_unit& msg, std::size_t n )
+{
+        if ( msg.which_sub != hub_to_unit_task_tag )
+                return;
+        auto& treq = msg.sub.task;
+        if ( treq.which_sub == task_req_progress_tag ) {
+                auto& m = treq.sub.progress.max_bytes;
+                if ( m == 0 || m > n )
+                        m = (uint32_t) n;
+        } else if ( treq.which_sub == task_req_read_tag ) {
+                auto& l = treq.sub.read.length;
+                l       = (uint32_t) std::min< std::size_t >( l, n );
+        }
+}
+
+/// Handles request `i` of a batch, always completes it in `join`, also when it is stopped. The
+/// reply is kept until the batch reply is sent. Output of progress and read requests is limited to
+/// `max_output` bytes.
+inline task< void > on_batch_entry(
+    task_ctx&                     ctx,
+    std::span< uint8_t >          buffer,
+    std::shared_ptr< batch_join > join,
+    std::size_t                   i,
+    std::span< uint8_t const >    data,
+    std::size_t                   max_output,
+    auto                          f )
+{
+        struct _guard
+        {
+                batch_join& join;
+                std::size_t i;
+                bool        completed = false;
+
+                ~_guard()
+                {
+                        if ( completed )
+                                join.withdraw( i );
+                        else
+                                join.complete( i, nullptr );
+                }
+        };
+
+        circular_buffer_memory mem{ buffer };
+        npb_istream_ctx        ictx{ .buff = data, .mem = mem };
+        pb_istream_t           stream = npb_istream_from( ictx );
+        hub_to_unit            msg    = {};
+        unit_to_hub            reply  = {};
+        bool                   ok     = false;
+        _guard                 guard{ *join, i };
+
+        if ( !pb_decode( &stream, hub_to_unit_fields, &msg ) ) {
+                spdlog::error( "Decoding error of batch entry {}: {}", i, PB_GET_ERROR( &stream ) );
+        } else if ( msg.which_sub == hub_to_unit_batch_tag ) {
+                spdlog::error( "Nested batch in batch entry {}", i );
+        } else {
+                limit_output( msg, max_output );
+                auto r = co_await ( f( ctx, mem, msg ) | ecor::err_to_val | ecor::as_variant );
+                if ( auto* rep = std::get_if< unit_to_hub >( &r ) ) {
+                        reply = *rep;
+                        ok    = true;
+                } else {
+                        spdlog::error( "Failed to handle batch entry {}", i );
+                }
+        }
+        guard.completed = true;
+        join->complete( i, ok ? &reply : nullptr );
+        while ( !join->released )
+                co_await join->sent.schedule();
+}
+
+/// Handles all requests of a batch concurrently, each in its own task slot created by `spawn`,
+/// and collects their replies in `join` in the order of the requests. The replies are valid until
+/// `join` is released. The reply fits `max_unit_message`, output of the requests gets an equal
+/// share of it and replies that still do not fit are marked as failed.
+inline task< unit_to_hub > on_batch(
+    task_ctx&                            ctx,
+    circular_buffer_memory&              mem,
+    hub_to_unit const&                   msg,
+    std::shared_ptr< batch_join > const& join,
+    auto                                 f,
+    auto                                 spawn )
+{
+        std::size_t n = 0;
+        for ( npb_data_list* e = msg.sub.batch.msgs; e != nullptr; e = e->next )
+                ++n;
+        spdlog::info( "Received batch of {} messages", n );
+
+        auto* p = (npb_data_list*) mem.allocate(
+            std::max< std::size_t >( n, 1 ) * sizeof( npb_data_list ), alignof( npb_data_list ) );
+        if ( p == nullptr ) {
+                spdlog::error( "Memory allocation failed for batch of {} messages", n );
+                co_yield ecor::with_error{ error::memory_allocation_failed };
+        }
+        join->replies = { p, n };
+        join->pending = n;
+        for ( std::size_t i = 0; i < n; ++i )
+                new ( &p[i] ) npb_data_list{
+                    .data = { .data = nullptr, .size = 0 },
+                    .next = i + 1 < n ? &p[i + 1] : nullptr,
+                };
+
+        // room of the batch reply itself and the headers of each reply
+        static constexpr std::size_t batch_overhead = 64;
+        static constexpr std::size_t reply_overhead = 256;
+
+        std::size_t const share =
+            ( max_unit_message - batch_overhead ) / std::max< std::size_t >( n, 1 );
+        std::size_t const max_output = share > reply_overhead ? share - reply_overhead : 1;
+
+        // entries decode their request from `mem` before their first suspension
+        std::size_t i = 0;
+        for ( npb_data_list* e = msg.sub.batch.msgs; e != nullptr; e = e->next, ++i ) {
+                std::span< uint8_t const > data{ e->data.data, e->data.size };
+                bool const                 spawned = spawn(
+                    [join, i, data, max_output, f]( task_ctx& ctx, std::span< uint8_t > buffer ) {
+                            return on_batch_entry( ctx, buffer, join, i, data, max_output, f );
+                    } );
+                if ( !spawned ) {
+                        spdlog::error( "No task slot for batch entry {}", i );
+                        join->complete( i, nullptr );
+                }
+        }
+        while ( join->pending != 0 )
+                co_await join->done.schedule();
+
+        // the hub drops larger frames, failing some replies lets the others arrive
+        std::size_t size = batch_overhead;
+        for ( std::size_t j = 0; j < n; ++j ) {
+                // tag and length of the entry
+                size += 4;
+                std::size_t m = 0;
+                if ( p[j].msg == nullptr )
+                        continue;
+                if ( pb_get_encoded_size( &m, p[j].fields, p[j].msg ) &&
+                     size + m <= max_unit_message ) {
+                        size += m;
+                        continue;
+                }
+                spdlog::error( "Reply {} of batch does not fit, {} bytes", j, m );
+                join->withdraw( j );
+        }
+
+        unit_to_hub reply    = prepare_reply( ctx.loop, msg.req_id );
+        reply.which_sub      = unit_to_hub_batch_tag;
+        reply.sub.batch.msgs = n != 0 ? p : nullptr;
+        co_return reply;
+}
+
+inline task< void > on_raw_msg(
+    task_ctx&            ctx,
+    client::promise      p,
+    std::span< uint8_t > buffer,
+    auto                 f,
+    auto                 spawn )
+{
+        // p.data points into the receive buffer, it has to be decoded before the first suspension
         circular_buffer_memory mem{ buffer };
         npb_istream_ctx        octx{ .buff = p.data, .mem = mem };
         pb_istream_t           stream = npb_istream_from( octx );
@@ -379,26 +771,37 @@ on_raw_msg( task_ctx& ctx, client::promise p, std::span< uint8_t > buffer, auto
                 co_yield ecor::with_error{ error::decoding_failed };
         }
 
-        unit_to_hub reply = co_await f( ctx, mem, hu_msg );
+        // replies of batch entries are encoded straight from their tasks, which wait until the
+        // batch reply is sent or this task is gone
+        struct _release
+        {
+                std::shared_ptr< batch_join >& join;
 
-        static constexpr std::size_t repl_size = 1024;
+                ~_release()
+                {
+                        if ( join )
+                                join->release();
+                }
+        };
+        std::shared_ptr< batch_join > join;
+        _release                      release{ join };
 
-        auto* pp = (uint8_t*) mem.allocate( repl_size, 1 );
-        if ( pp == nullptr ) {
-                spdlog::error(
-                    "Memory allocation failed, {}/{}", mem.used_bytes(), mem.capacity() );
-                co_yield ecor::with_error{ error::memory_allocation_failed };
+        unit_to_hub reply;
+        if ( hu_msg.which_sub == hub_to_unit_batch_tag ) {
+                join  = std::make_shared< batch_join >();
+                reply = co_await on_batch( ctx, mem, hu_msg, join, f, spawn );
+        } else {
+                reply = co_await f( ctx, mem, hu_msg );
         }
-        npb_ostream_ctx ictx{ .buff = { pp, repl_size } };
-        pb_ostream_t    ostream = npb_ostream_from( ictx );
-        if ( !pb_encode( &ostream, unit_to_hub_fields, &reply ) ) {
-                spdlog::error( "Encoding error: {}", PB_GET_ERROR( &ostream ) );
+
+        // a slow hub throttles the handling of its requests instead of exhausting the send buffer
+        co_await p.c.gate.writable();
+
+        // batches and coalesced progress reports vary a lot in size, the frame is sized to fit
+        if ( p.fullfill( unit_to_hub_fields, &reply ) != send_status::SUCCESS ) {
+                spdlog::error( "Failed to send reply to request {}", reply.req_id );
                 co_yield ecor::with_error{ error::encoding_failed };
         }
-        spdlog::debug( "Sending: {}", std::vector< int >{ pp, pp + ostream.bytes_written } );
-        // XXX: no ignore
-        std::ignore = p.fullfill( { pp, ostream.bytes_written } );
-        mem.deallocate( pp, repl_size, 1 );
 }
 
 template < typename R >
@@ -425,6 +828,10 @@ struct unit_transaction_cb : R
                                      hub_to_unit             msg ) -> task< unit_to_hub > {
                                         return on_msg(
                                             ctx, mem, uctx.fctx, uctx.folctx, uctx.pctx, msg );
+                                },
+                                [&]( auto&& f ) {
+                                        return uctx.slots.emplace_slot(
+                                            uctx.loop, (decltype( f )&&) f );
                                 } );
                     } );
                 R::set_value();
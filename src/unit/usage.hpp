@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <utility>
+
+namespace trctl
+{
+
+/// Resources used by a task, CPU time includes the processes it waited for
+struct proc_usage
+{
+        uint64_t wall_us    = 0;
+        uint64_t user_us    = 0;
+        uint64_t sys_us     = 0;
+        uint64_t max_rss_kb = 0;
+        // bytes the task caused to be fetched from and sent to storage
+        uint64_t read_bytes  = 0;
+        uint64_t write_bytes = 0;
+
+        /// Keeps the larger of each counter, the wall time is not touched
+        void merge_max( proc_usage const& o )
+        {
+                user_us     = std::max( user_us, o.user_us );
+                sys_us      = std::max( sys_us, o.sys_us );
+                max_rss_kb  = std::max( max_rss_kb, o.max_rss_kb );
+                read_bytes  = std::max( read_bytes, o.read_bytes );
+                write_bytes = std::max( write_bytes, o.write_bytes );
+        }
+};
+
+/// Reads the counters of a live process from /proc, false if it is gone. The memory high water
+/// mark and io of the processes it waited for are not included.
+inline bool sample_proc( int pid, proc_usage& u )
+{
+        std::string const dir = "/proc/" + std::to_string( pid );
+
+        std::ifstream stat{ dir + "/stat" };
+        std::string   line;
+        if ( !std::getline( stat, line ) )
+                return false;
+        // the command name may contain spaces, fields are counted from the closing paren
+        auto paren = line.rfind( ')' );
+        if ( paren == std::string::npos )
+                return false;
+        std::istringstream fields{ line.substr( paren + 2 ) };
+        std::string        skip;
+        for ( int i = 3; i < 14; ++i )
+                fields >> skip;
+        uint64_t utime = 0, stime = 0, cutime = 0, cstime = 0;
+        if ( !( fields >> utime >> stime >> cutime >> cstime ) )
+                return false;
+        uint64_t const tick_us = 1'000'000 / sysconf( _SC_CLK_TCK );
+        u.user_us              = ( utime + cutime ) * tick_us;
+        u.sys_us               = ( stime + cstime ) * tick_us;
+
+        std::ifstream status{ dir + "/status" };
+        while ( std::getline( status, line ) )
+                if ( line.starts_with( "VmHWM:" ) )
+                        u.max_rss_kb = std::stoull( line.substr( 6 ) );
+
+        std::ifstream io{ dir + "/io" };
+        while ( std::getline( io, line ) ) {
+                if ( line.starts_with( "read_bytes:" ) )
+                        u.read_bytes = std::stoull( line.substr( 11 ) );
+                else if ( line.starts_with( "write_bytes:" ) )
+                        u.write_bytes = std::stoull( line.substr( 12 ) );
+        }
+        return true;
+}
+
+/// Usage of all children reaped by this process since the previous call. The max RSS is only set
+/// if one of them exceeded every child reaped before.
+inline proc_usage reaped_since_last()
+{
+        static rusage last = {};
+
+        rusage now;
+        if ( getrusage( RUSAGE_CHILDREN, &now ) != 0 )
+                return {};
+        auto us = []( timeval const& t ) {
+                return (uint64_t) t.tv_sec * 1'000'000 + (uint64_t) t.tv_usec;
+        };
+        proc_usage res;
+        res.user_us = us( now.ru_utime ) - us( last.ru_utime );
+        res.sys_us  = us( now.ru_stime ) - us( last.ru_stime );
+        if ( now.ru_maxrss > last.ru_maxrss )
+                res.max_rss_kb = now.ru_maxrss;
+        // counted in blocks of 512 bytes, as read_bytes and write_bytes of /proc/<pid>/io
+        res.read_bytes  = (uint64_t) ( now.ru_inblock - last.ru_inblock ) * 512;
+        res.write_bytes = (uint64_t) ( now.ru_oublock - last.ru_oublock ) * 512;
+        last            = now;
+        return res;
+}
+
+/// Tells which task the usage of reaped children belongs to. libuv reaps every exited child
+/// before it runs any exit callback, so the usage is only charged if a single task was reaped
+/// since the last settle() and nothing else.
+struct reap_ledger
+{
+        void reaped_task( uint32_t task_id )
+        {
+                ++_n;
+                _task_id = task_id;
+        }
+
+        /// A child that is not a task was reaped, the usage reaped along with it is dropped
+        void reaped_other()
+        {
+                reaped_since_last();
+                _n = 0;
+        }
+
+        /// Usage reaped since the last call and the task it belongs to, if one can tell
+        std::pair< std::optional< uint32_t >, proc_usage > settle()
+        {
+                std::optional< uint32_t > id;
+                if ( _n == 1 )
+                        id = _task_id;
+                _n = 0;
+                return { id, reaped_since_last() };
+        }
+
+private:
+        std::size_t _n       = 0;
+        uint32_t    _task_id = 0;
+};
+
+}  // namespace trctl
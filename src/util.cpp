@@ -34,41 +34,226 @@ addr_info get_connection_info( uv_tcp_t const* c, sock_kind kind )
         return info;
 }
 
-static inline void cobs_send_write_cb( uv_write_t* req, int status )
+void write_gate::wait( write_waiter& w )
 {
-        if ( status < 0 )
-                spdlog::error( "Write error {}\n", uv_strerror( status ) );
-        auto* wr = (tcp_send_req*) req;
-        auto& m  = wr->mem;
-        std::destroy_at( wr );
-        m.deallocate( wr, sizeof( tcp_send_req ), alignof( tcp_send_req ) );
+        if ( w._waiting )
+                return;
+        w._waiting = true;
+        w._next    = nullptr;
+        if ( _tail )
+                _tail->_next = &w;
+        else
+                _head = &w;
+        _tail = &w;
+}
+
+void write_gate::cancel( write_waiter& w )
+{
+        if ( !w._waiting )
+                return;
+        w._waiting         = false;
+        write_waiter* prev = nullptr;
+        for ( auto* x = _head; x; prev = x, x = x->_next ) {
+                if ( x != &w )
+                        continue;
+                if ( prev )
+                        prev->_next = w._next;
+                else
+                        _head = w._next;
+                if ( _tail == &w )
+                        _tail = prev;
+                return;
+        }
+}
+
+void write_gate::_on_queued()
+{
+        std::size_t const q = uv_stream_get_write_queue_size( stream ) + held;
+        _stats.max_queued   = std::max< uint64_t >( _stats.max_queued, q );
+        if ( _blocked || q <= high_watermark )
+                return;
+        _blocked       = true;
+        _blocked_since = uv_hrtime();
+        ++_stats.blocked;
+}
+
+void write_gate::_on_written()
+{
+        if ( !_blocked || uv_stream_get_write_queue_size( stream ) + held > low_watermark )
+                return;
+        _blocked = false;
+        _stats.blocked_ns += uv_hrtime() - _blocked_since;
+        // resumed producers may fill the queue again, the rest keeps waiting in that case
+        while ( _head && !_blocked ) {
+                auto* w = _head;
+                _head   = w->_next;
+                if ( !_head )
+                        _tail = nullptr;
+                w->_waiting = false;
+                w->on_writable();
+        }
 }
 
-send_status cobs_send( circular_buffer_memory& mem, uv_tcp_t* c, std::span< uint8_t const > data )
+send_status frame_sender::send( std::span< uint8_t const > data )
 {
-        auto wr_ptr = mem.make< tcp_send_req >(
-            tcp_send_req{ mem.make_span< uint8_t >( 3 + data.size() * 258 / 255 ), mem } );
-        auto [succ, used] = encode_cobs(
-            data, std::span< uint8_t >{ wr_ptr->buff }.subspan( 0, wr_ptr->buff.size() - 1 ) );
+        _frame* f = _alloc( data.size() );
+        if ( f == nullptr )
+                return send_status::WRITE_ERROR;
+        auto [succ, used] = encode_cobs( data, f->payload() );
         if ( !succ ) {
                 spdlog::error( "COBS encoding failed, message too large" );
+                _release( f );
                 return send_status::ENCODING_ERROR;
         }
-        wr_ptr->buf = uv_buf_init( (char*) used.data(), used.size() + 1 );
-        int r       = uv_write(
-            (uv_write_t*) wr_ptr.get(), (uv_stream_t*) c, &wr_ptr->buf, 1, cobs_send_write_cb );
+        return _enqueue( f, used.size() );
+}
+
+frame_sender::_frame* frame_sender::_alloc( std::size_t size )
+{
+        std::size_t const alloc = frame_footprint( size );
+        // large frames come from the pool, so that the buffer of a connection stays sized for
+        // regular messages and a stream of chunks does not malloc each of them
+        bool const heap = alloc > mem.capacity() / 4;
+        _frame*    f    = nullptr;
+        if ( !heap )
+                f = (_frame*) mem.allocate( alloc, alignof( _frame ) );
+        else if ( pool )
+                f = (_frame*) pool->acquire( alloc );
+        else
+                f = (_frame*) ::operator new( alloc, std::nothrow );
+        if ( f == nullptr ) {
+                spdlog::error(
+                    "Memory allocation failed for frame of {} bytes, {}/{}",
+                    size,
+                    mem.used_bytes(),
+                    mem.capacity() );
+                return nullptr;
+        }
+        return new ( f )
+            _frame{ .next = nullptr, .alloc = alloc, .size = 0, .offset = 0, .heap = heap };
+}
+
+send_status frame_sender::_enqueue( _frame* f, std::size_t encoded )
+{
+        f->data()[encoded] = 0;
+        f->size            = encoded + 1;
+        ++_stats.frames;
+
+        // frames stay in order, so only a frame sent while nothing is in flight can go directly
+        if ( !_in_flight ) {
+                uv_buf_t  buf = uv_buf_init( (char*) f->data(), f->size );
+                int const r   = uv_try_write( stream, &buf, 1 );
+                if ( r == (int) f->size ) {
+                        ++_stats.direct;
+                        _release( f );
+                        return send_status::SUCCESS;
+                }
+                if ( r < 0 && r != UV_EAGAIN ) {
+                        spdlog::error( "uv_try_write failed: {}", uv_strerror( r ) );
+                        _release( f );
+                        return send_status::WRITE_ERROR;
+                }
+                if ( r > 0 )
+                        f->offset = r;
+        }
+
+        if ( _tail )
+                _tail->next = f;
+        else
+                _head = f;
+        _tail = f;
+        gate.held += f->size - f->offset;
+        if ( !_in_flight && _flush() != 0 )
+                return send_status::WRITE_ERROR;
+        gate._on_queued();
+        return send_status::SUCCESS;
+}
+
+int frame_sender::_flush()
+{
+        auto* req = (_write_req*) mem.allocate( sizeof( _write_req ), alignof( _write_req ) );
+        if ( req == nullptr ) {
+                spdlog::error( "Memory allocation failed for write request" );
+                _drop_pending();
+                return UV_ENOMEM;
+        }
+        req->sender = this;
+        req->frames = _head;
+
+        unsigned n    = 0;
+        _frame*  last = nullptr;
+        for ( auto* f = _head; f && n < max_gather; f = f->next ) {
+                req->bufs[n++] = uv_buf_init( (char*) f->data() + f->offset, f->size - f->offset );
+                gate.held -= f->size - f->offset;
+                last = f;
+        }
+        _head      = last->next;
+        last->next = nullptr;
+        if ( !_head )
+                _tail = nullptr;
+
+        int const r = uv_write( req, stream, req->bufs, n, _on_write );
         if ( r ) {
                 spdlog::error( "uv_write failed: {}", uv_strerror( r ) );
-                return send_status::WRITE_ERROR;
+                for ( auto* f = req->frames; f; ) {
+                        auto* next = f->next;
+                        _release( f );
+                        f = next;
+                }
+                mem.deallocate( req, sizeof( _write_req ), alignof( _write_req ) );
+                _drop_pending();
+                return r;
         }
+        _in_flight = true;
+        ++_stats.writes;
+        return 0;
+}
 
-        std::ignore = wr_ptr.release();
-        return send_status::SUCCESS;
+void frame_sender::_drop_pending()
+{
+        while ( _head ) {
+                auto* f = _head;
+                _head   = f->next;
+                gate.held -= f->size - f->offset;
+                _release( f );
+        }
+        _tail = nullptr;
+}
+
+void frame_sender::_release( _frame* f )
+{
+        if ( f->heap && pool )
+                pool->release( (uint8_t*) f, buffer_pool::capacity_for( f->alloc ) );
+        else if ( f->heap )
+                ::operator delete( f );
+        else
+                mem.deallocate( f, f->alloc, alignof( _frame ) );
+}
+
+void frame_sender::_on_write( uv_write_t* req, int status )
+{
+        auto& wr = *(_write_req*) req;
+        auto& s  = *wr.sender;
+        if ( status < 0 )
+                spdlog::error( "Write error {}", uv_strerror( status ) );
+        for ( auto* f = wr.frames; f; ) {
+                auto* next = f->next;
+                s._release( f );
+                f = next;
+        }
+        s.mem.deallocate( &wr, sizeof( _write_req ), alignof( _write_req ) );
+        s._in_flight = false;
+        // frames gathered meanwhile go out in one write, before waiting producers are resumed
+        if ( status < 0 )
+                s._drop_pending();
+        else if ( s._head )
+                std::ignore = s._flush();
+        s.gate._on_written();
 }
 
-void cobs_receiver::_handle_rx( std::span< uint8_t const > data )
+void cobs_receiver::_commit_rx( std::size_t count )
 {
-        _handle_rx( data, [&]( std::span< uint8_t const > d ) {
+        _commit_rx( count, [&]( std::span< uint8_t const > d ) {
                 recv_src.set_value( reply{ .data = d } );
         } );
 }
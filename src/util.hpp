@@ -1,10 +1,13 @@
 #pragma once
 
 #include "cobs.hpp"
+#include "util/buffer_pool.hpp"
 
 #include <algorithm>
+#include <cstring>
 #include <ecor/ecor.hpp>
 #include <map>
+#include <optional>
 #include <set>
 #include <span>
 #include <spdlog/spdlog.h>
@@ -59,19 +62,181 @@ using set =
     std::set< T, std::less< void >, ecor::circular_buffer_allocator< T, uint64_t, dealloc_iface > >;
 
 
-struct tcp_send_req : uv_write_t
+/// Stop token in the environment of receiver `r`, a token that never stops if there is none
+template < typename R >
+auto stop_token_of( R const& r ) noexcept
 {
-        uv_buf_t                                 buf;
-        circular_buffer_memory::uspan< uint8_t > buff;
-        circular_buffer_memory&                  mem;
+        if constexpr ( requires { ecor::get_env( r ).query( ecor::get_stop_token_t{} ); } )
+                return ecor::get_env( r ).query( ecor::get_stop_token_t{} );
+        else
+                return ecor::inplace_stop_token{};
+}
 
-        tcp_send_req( circular_buffer_memory::uspan< uint8_t > b, circular_buffer_memory& m )
-          : buff( std::move( b ) )
-          , mem( m )
+/// Calls on_stop() of an operation once stop is requested on the token of its receiver
+template < typename Op >
+struct stop_hook
+{
+        Op* op;
+
+        void operator()() noexcept
+        {
+                op->on_stop();
+        }
+};
+
+/// Emplaced by an operation in start(), the operation has to outlive it
+template < typename Op >
+using stop_callback = ecor::inplace_stop_callback< stop_hook< Op > >;
+
+/// Producer waiting for room in the write queue of a stream, see write_gate::wait()
+struct write_waiter
+{
+        virtual void on_writable() = 0;
+
+        write_waiter* _next    = nullptr;
+        bool          _waiting = false;
+};
+
+/// Bounds the bytes queued for writing to a stream. Once the write queue grows over
+/// `high_watermark`, producers wait until it drains under `low_watermark`, so that a slow peer
+/// throttles them instead of exhausting the memory of pending writes.
+struct write_gate
+{
+        struct stats
+        {
+                // times the queue went over the high watermark and how long it took to drain
+                uint64_t blocked    = 0;
+                uint64_t blocked_ns = 0;
+                // largest write queue seen
+                uint64_t max_queued = 0;
+        };
+
+        uv_stream_t* stream;
+        std::size_t  high_watermark = 64 * 1024;
+        std::size_t  low_watermark  = 16 * 1024;
+        /// Bytes the producer holds back before they reach the write queue, counted as queued
+        std::size_t held = 0;
+
+        write_gate( uv_stream_t* s )
+          : stream( s )
+        {
+        }
+
+        write_gate( write_gate const& )            = delete;
+        write_gate& operator=( write_gate const& ) = delete;
+
+        bool blocked() const
+        {
+                return _blocked;
+        }
+
+        /// Resumes `w` once the queue drains, waiters are resumed in order. Does nothing if `w`
+        /// already waits.
+        void wait( write_waiter& w );
+
+        /// Removes `w` in case it still waits
+        void cancel( write_waiter& w );
+
+        template < typename R >
+        struct _writable_op : write_waiter
+        {
+                using operation_state_concept = ecor::operation_state_t;
+
+                write_gate*                                    _gate;
+                R                                              _recv;
+                std::optional< stop_callback< _writable_op > > _stop;
+
+                _writable_op( write_gate* g, R r )
+                  : _gate( g )
+                  , _recv( std::move( r ) )
+                {
+                }
+
+                _writable_op( _writable_op const& )            = delete;
+                _writable_op& operator=( _writable_op const& ) = delete;
+
+                // an op destroyed while waiting must not be resumed by the gate
+                ~_writable_op()
+                {
+                        _gate->cancel( *this );
+                }
+
+                void start()
+                {
+                        auto token = stop_token_of( _recv );
+                        if ( token.stop_requested() ) {
+                                _recv.set_stopped();
+                                return;
+                        }
+                        if ( !_gate->blocked() ) {
+                                _recv.set_value();
+                                return;
+                        }
+                        _gate->wait( *this );
+                        _stop.emplace( token, stop_hook< _writable_op >{ this } );
+                }
+
+                void on_writable() override
+                {
+                        _stop.reset();
+                        _recv.set_value();
+                }
+
+                void on_stop()
+                {
+                        _gate->cancel( *this );
+                        _recv.set_stopped();
+                }
+        };
+
+        struct _writable_sender
+        {
+                using sender_concept = ecor::sender_t;
+
+                write_gate* _gate;
+
+                template < typename Env >
+                using completion_signatures =
+                    ecor::completion_signatures< ecor::set_value_t(), ecor::set_stopped_t() >;
+
+                template < typename Env >
+                completion_signatures< Env > get_completion_signatures( Env&& )
+                {
+                        return {};
+                }
+
+                template < typename R >
+                auto connect( R rec ) noexcept
+                {
+                        return _writable_op< R >{ _gate, std::move( rec ) };
+                }
+        };
+
+        /// Completes right away unless the gate is blocked, otherwise once the queue drains or
+        /// stopped once stop is requested
+        _writable_sender writable()
+        {
+                return { this };
+        }
+
+        stats const& get_stats() const
         {
+                return _stats;
         }
+
+        /// Called by frame_sender once a frame got queued and once a write finished
+        void _on_queued();
+        void _on_written();
+
+private:
+        bool          _blocked       = false;
+        uint64_t      _blocked_since = 0;
+        write_waiter* _head          = nullptr;
+        write_waiter* _tail          = nullptr;
+        stats         _stats;
 };
 
+
 enum class [[nodiscard]] send_status
 {
         ENCODING_ERROR,
@@ -80,43 +245,192 @@ enum class [[nodiscard]] send_status
 };
 
 
-send_status cobs_send( circular_buffer_memory& mem, uv_tcp_t* c, std::span< uint8_t const > data );
+/// Writes COBS frames to a stream. When nothing is queued, a frame is written right away with
+/// uv_try_write() and only what the socket did not take gets queued. Frames sent while a write is
+/// in flight are gathered and written with one vectored uv_write() once it completes. Frames are
+/// allocated from `mem` and accounted in `gate`, producers are expected to wait for it.
+struct frame_sender
+{
+        // buffers of one gathered write, libuv copies larger arrays to the heap
+        static constexpr std::size_t max_gather = 16;
+
+        struct stats
+        {
+                // frames sent and those written completely by uv_try_write()
+                uint64_t frames = 0;
+                uint64_t direct = 0;
+                // uv_write() calls, each with one or more frames
+                uint64_t writes = 0;
+        };
+
+        uv_stream_t*            stream;
+        circular_buffer_memory& mem;
+        write_gate&             gate;
+        /// Frames taking a large part of `mem`, like file transfer chunks, are taken from here
+        /// if set and from the heap otherwise
+        buffer_pool* pool = nullptr;
+
+        frame_sender( uv_stream_t* s, circular_buffer_memory& m, write_gate& g )
+          : stream( s )
+          , mem( m )
+          , gate( g )
+        {
+        }
+
+        frame_sender( frame_sender const& )            = delete;
+        frame_sender& operator=( frame_sender const& ) = delete;
+
+        send_status send( std::span< uint8_t const > data );
+
+        /// Sends a frame with `size` bytes of payload, which `encode` feeds to the COBS encoder
+        /// of the frame, so the payload is never stored on its own. `encode` returns false on
+        /// failure.
+        template < typename F >
+        send_status send_encoded( std::size_t size, F&& encode )
+        {
+                _frame* f = _alloc( size );
+                if ( f == nullptr )
+                        return send_status::WRITE_ERROR;
+                cobs_encoder enc{ f->payload() };
+                if ( !encode( enc ) ) {
+                        _release( f );
+                        return send_status::ENCODING_ERROR;
+                }
+                return _enqueue( f, std::move( enc ).commit().size() );
+        }
 
+        stats const& get_stats() const
+        {
+                return _stats;
+        }
+
+        /// Bytes of `mem` taken by a frame with `size` bytes of payload until it is written
+        static constexpr std::size_t frame_footprint( std::size_t size )
+        {
+                // worst case of COBS, the delimiter and one spare byte the encoders need
+                return sizeof( _frame ) + 3 + size * 258 / 255;
+        }
+
+        /// Bytes of `mem` taken by one write of gathered frames until it completes
+        static constexpr std::size_t write_footprint()
+        {
+                return sizeof( _write_req );
+        }
 
+private:
+        struct _frame
+        {
+                _frame*     next;
+                std::size_t alloc;
+                // encoded bytes including the delimiter and how many of them were written
+                std::size_t size;
+                std::size_t offset;
+                // allocated from `pool` or the heap instead of `mem`
+                bool heap;
+
+                uint8_t* data()
+                {
+                        return (uint8_t*) ( this + 1 );
+                }
+
+                /// Room for the encoded payload, the delimiter follows it
+                std::span< uint8_t > payload()
+                {
+                        return { data(), alloc - sizeof( _frame ) - 1 };
+                }
+        };
+
+        struct _write_req : uv_write_t
+        {
+                frame_sender* sender;
+                _frame*       frames;
+                uv_buf_t      bufs[max_gather];
+        };
+
+        _frame*     _alloc( std::size_t size );
+        send_status _enqueue( _frame* f, std::size_t encoded );
+        int         _flush();
+        void        _drop_pending();
+        void        _release( _frame* f );
+        static void _on_write( uv_write_t* req, int status );
+
+        // frames not handed to libuv yet, there are none unless a write is in flight
+        _frame* _head      = nullptr;
+        _frame* _tail      = nullptr;
+        bool    _in_flight = false;
+        stats   _stats;
+};
+
+
+// Receiver of COBS framed stream. Bytes are appended at `rx_used`, each byte is scanned for the
+// delimiter exactly once (`rx_scan`) and complete frames are decoded in place starting at
+// `rx_start`. Data gets moved only when the end of the buffer is reached and an incomplete frame
+// has to be moved to the front.
 struct cobs_receiver
 {
-        void _handle_rx( std::span< uint8_t const > data );
-
-        void _handle_rx( std::span< uint8_t const > data, auto&& f )
+        /// Free part of the receive buffer. Readers hand this window to libuv so that incoming
+        /// bytes land directly in place and are followed by _commit_rx(). In case the buffer is
+        /// full without containing a complete frame, the frame is dropped up to the next
+        /// delimiter.
+        std::span< uint8_t > rx_window()
         {
-                auto iter = rx_buffer.begin() + rx_used;
-                if ( (std::size_t) std::distance( iter, rx_buffer.end() ) < data.size() ) {
+                if ( rx_used == rx_buffer.size() && rx_start != 0 )
+                        _compact();
+                if ( rx_used == rx_buffer.size() ) {
                         spdlog::error(
-                            "Failed to handle cobs rx, message too large: size: {} capacity: {}",
-                            data.size(),
-                            std::distance( iter, rx_buffer.end() ) );
-                        std::abort();
-                        // XXX: improve
+                            "Failed to handle cobs rx, message too large: capacity: {}",
+                            rx_buffer.size() );
+                        rx_start = rx_scan = rx_used = 0;
+                        rx_skip                       = true;
                 }
-                std::copy_n( data.begin(), data.size(), iter );
-                rx_used += data.size();
+                return rx_buffer.subspan( rx_used );
+        }
+
+        void _compact()
+        {
+                std::copy(
+                    rx_buffer.begin() + rx_start, rx_buffer.begin() + rx_used, rx_buffer.begin() );
+                rx_scan -= rx_start;
+                rx_used -= rx_start;
+                rx_start = 0;
+        }
+
+        void _commit_rx( std::size_t count );
+
+        /// Marks `count` bytes written at the start of rx_window() as received and decodes all
+        /// complete frames in place, `f` gets called with each decoded frame.
+        void _commit_rx( std::size_t count, auto&& f )
+        {
+                rx_used += count;
+                uint8_t* const b = rx_buffer.data();
                 for ( ;; ) {
-                        auto buff = std::span{ rx_buffer }.subspan( 0, rx_used );
-                        auto iter = std::ranges::find( buff, 0x00u );
-                        if ( iter == buff.end() )
+                        auto* z = (uint8_t*) std::memchr( b + rx_scan, 0x00, rx_used - rx_scan );
+                        if ( !z )
                                 break;
+                        auto msg = rx_buffer.subspan( rx_start, z - ( b + rx_start ) );
+                        rx_scan = rx_start = z - b + 1;
 
-                        auto n = std::distance( buff.begin(), iter );
-
-                        auto msg = buff.subspan( 0, n );
+                        if ( std::exchange( rx_skip, false ) || msg.empty() )
+                                continue;
 
                         auto [succ, used] = decode_cobs( msg, msg );
                         std::ignore       = succ;  // assert?
 
                         f( used );
+                }
+                rx_scan = rx_used;
+                if ( rx_start == rx_used )
+                        rx_start = rx_scan = rx_used = 0;
+        }
 
-                        std::copy( iter + 1, buff.end(), rx_buffer.begin() );
-                        rx_used = std::distance( iter + 1, buff.end() );
+        void _handle_rx( std::span< uint8_t const > data, auto&& f )
+        {
+                while ( !data.empty() ) {
+                        auto window = rx_window();
+                        auto n      = std::min( window.size(), data.size() );
+                        std::copy_n( data.begin(), n, window.begin() );
+                        data = data.subspan( n );
+                        _commit_rx( n, f );
                 }
         }
 
@@ -136,8 +450,10 @@ struct cobs_receiver
         }
 
         std::span< uint8_t > rx_buffer;
+        std::size_t          rx_start = 0;
+        std::size_t          rx_scan  = 0;
         std::size_t          rx_used;
-
+        bool                 rx_skip = false;
 
         ecor::broadcast_source< ecor::set_value_t( reply ), ecor::set_error_t( err ) > recv_src;
 };
@@ -158,7 +474,8 @@ enum class error
         libuv_error,
         memory_allocation_failed,
         task_error,
-        internal_error
+        internal_error,
+        no_space
 };
 
 constexpr error unify( std::variant< ecor::task_error, error > e )
@@ -192,6 +509,8 @@ constexpr char const* str( error e )
                 return "memory allocation failed";
         case error::task_error:
                 return "task error";
+        case error::no_space:
+                return "no space left on device";
         default:
                 return "unknown";
         }
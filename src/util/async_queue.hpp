@@ -1,6 +1,8 @@
 #pragma once
 
 #include <ecor/ecor.hpp>
+#include <memory>
+#include <optional>
 #include <zll.hpp>
 
 namespace trctl
@@ -29,25 +31,31 @@ struct async_queue
         {
                 zll::ll_list< _node >        queue;
                 zll::ll_list< _deque_iface > deque_waiters;
+                std::size_t                  size = 0;
         };
 
 
-        void enque( T&& item )
+        /// Queues the item or hands it to the first waiter, true if it got queued
+        bool enque( T&& item )
         {
-                if ( __core.deque_waiters.empty() )
+                if ( __core.deque_waiters.empty() ) {
                         __core.queue.link_back( *( new _node{ std::move( item ) } ) );
-                else {
+                        ++__core.size;
+                        return true;
+                } else {
                         auto& waiter = __core.deque_waiters.front();
                         __core.deque_waiters.detach_front();
                         waiter.do_start( item );
+                        return false;
                 }
         }
 
         void enque_all( T&& item )
         {
-                if ( __core.deque_waiters.empty() )
+                if ( __core.deque_waiters.empty() ) {
                         __core.queue.link_back( *( new _node{ std::move( item ) } ) );
-                else
+                        ++__core.size;
+                } else
                         while ( !__core.deque_waiters.empty() ) {
                                 auto& waiter = __core.deque_waiters.front();
                                 __core.deque_waiters.detach_front();
@@ -55,6 +63,31 @@ struct async_queue
                         }
         }
 
+        /// First queued item, nullptr if the queue is empty
+        T* front()
+        {
+                if ( __core.queue.empty() )
+                        return nullptr;
+                return &__core.queue.front().item;
+        }
+
+        /// Number of queued items
+        std::size_t size() const
+        {
+                return __core.size;
+        }
+
+        /// Removes the first queued item without waiting for one
+        std::optional< T > try_deque()
+        {
+                if ( __core.queue.empty() )
+                        return std::nullopt;
+                std::unique_ptr< _node > n{ &__core.queue.front() };
+                __core.queue.detach_front();
+                --__core.size;
+                return std::move( n->item );
+        }
+
         struct _deq_sender
         {
                 using sender_concept = ecor::sender_t;
@@ -86,6 +119,7 @@ struct async_queue
                                 else {
                                         std::unique_ptr< _node > n{ &core.queue.front() };
                                         core.queue.detach_front();
+                                        --core.size;
                                         do_start( n->item );
                                 }
                         }
@@ -5,7 +5,7 @@
 namespace trctl
 {
 
-// FIFO sender that ensures that only one operation is active at a time
+// FIFO sender that ensures that at most `limit` operations are active at a time, one by default
 struct async_sender_fifo
 {
         struct _start_iface : zll::ll_base< _start_iface >
@@ -15,12 +15,13 @@ struct async_sender_fifo
         struct _core
         {
                 zll::ll_list< _start_iface > waiters;
-                _start_iface*                current = nullptr;
+                std::size_t                  active = 0;
+                std::size_t                  limit  = 1;
 
                 void on_start( _start_iface& op )
                 {
-                        if ( !current ) {
-                                current = &op;
+                        if ( active < limit ) {
+                                ++active;
                                 op.do_start();
                                 return;
                         } else
@@ -29,16 +30,21 @@ struct async_sender_fifo
 
                 void on_end()
                 {
-                        current = nullptr;
+                        --active;
                         if ( !waiters.empty() ) {
                                 auto& op = waiters.front();
                                 waiters.detach_front();
-                                current = &op;
+                                ++active;
                                 op.do_start();
                         }
                 }
         };
 
+        async_sender_fifo( std::size_t limit = 1 )
+        {
+                core.limit = limit;
+        }
+
         template < typename S >
         struct _sender
         {
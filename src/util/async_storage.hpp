@@ -30,6 +30,13 @@ struct async_map_core_base
 {
         zll::ll_list< async_ptr_core< T > > to_del;
         async_ptr_core< T >*                to_erase = nullptr;
+        component*                          owner    = nullptr;
+
+        void schedule()
+        {
+                if ( owner )
+                        owner->schedule_tick();
+        }
 
         virtual void clear( async_ptr_core< T >& ) = 0;
 };
@@ -139,13 +146,23 @@ struct async_ptr
                 return &c->item;
         }
 
+        /// Another reference to the item, it is destroyed once all of them are gone
+        async_ptr share() const
+        {
+                if ( !c )
+                        return {};
+                return { *c };
+        }
+
         ~async_ptr()
         {
                 if ( !c )
                         return;
                 c->cnt--;
-                if ( c->cnt == 0 )
+                if ( c->cnt == 0 ) {
                         c->raii_core.to_del.link_back( *c );
+                        c->raii_core.schedule();
+                }
         }
 
 private:
@@ -185,6 +202,7 @@ struct async_map : component
         async_map( uv_loop_t* l, task_core& c, std::span< uint8_t > mem_buffer )
           : component( l, c, mem_buffer )
         {
+                _core.owner = this;
         }
 
         template < typename... Args >
@@ -255,14 +273,16 @@ struct async_map : component
         task< void > shutdown() override
         {
                 _core.m.clear();
-                if ( !_core.to_del.empty() )
+                if ( !_core.to_del.empty() || _destroy_task ) {
+                        _shutting_down = true;
                         co_await _on_all_destroyed.schedule();
+                }
                 co_return;
         }
 
         ~async_map()
         {
-                uv_idle_stop( &idle );
+                _core.owner = nullptr;
                 while ( !_core.to_del.empty() ) {
                         auto& x = _core.to_del.take_front();
                         delete &x;
@@ -281,7 +301,8 @@ private:
                         _destroy_task = do_destroy( (task_ctx&) *this, x.item )
                                             .connect( _destroy_recv{ this, &x } );
                         _destroy_task.start();
-                } else if ( !!_destroy_task && _core.to_del.empty() ) {
+                } else if ( _shutting_down && !_destroy_task ) {
+                        _shutting_down = false;
                         _on_all_destroyed.set_value();
                 }
         }
@@ -296,16 +317,19 @@ private:
                 void set_value()
                 {
                         map->_core.to_erase = x;
+                        map->schedule_tick();
                 }
 
                 void set_error( auto&& )
                 {
                         map->_core.to_erase = x;
+                        map->schedule_tick();
                 }
 
                 void set_stopped()
                 {
                         map->_core.to_erase = x;
+                        map->schedule_tick();
                 }
         };
 
@@ -313,6 +337,8 @@ private:
         async_map_core< K, T >                            _core;
         ecor::broadcast_source< ecor::set_value_t() >     _on_all_destroyed;
         ecor::connect_type< task< void >, _destroy_recv > _destroy_task;
+        // shutdown() waits for `_on_all_destroyed`
+        bool _shutting_down = false;
 };
 
 }  // namespace trctl
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace trctl
+{
+
+/// Buffers in power of two size classes from 256 B to 64 KiB. Released buffers are kept in a free
+/// list per class and handed out again, so a steady stream of reads does not touch the heap.
+/// Larger requests and releases over `max_cached` go to malloc/free.
+struct buffer_pool
+{
+        static constexpr std::size_t min_shift = 8;
+        static constexpr std::size_t max_shift = 16;
+        static constexpr std::size_t classes   = max_shift - min_shift + 1;
+        static constexpr std::size_t max_size  = std::size_t{ 1 } << max_shift;
+
+        struct stats
+        {
+                // buffers handed out and returned
+                uint64_t acquired = 0;
+                uint64_t released = 0;
+                // buffers taken from and returned to the heap
+                uint64_t mallocs = 0;
+                uint64_t frees   = 0;
+                // bytes held by the free lists
+                uint64_t cached_bytes = 0;
+        };
+
+        std::size_t max_cached = 4 * 1024 * 1024;
+
+        buffer_pool() = default;
+
+        buffer_pool( buffer_pool const& )            = delete;
+        buffer_pool& operator=( buffer_pool const& ) = delete;
+
+        ~buffer_pool()
+        {
+                for ( auto*& head : _free ) {
+                        while ( head ) {
+                                auto* n = head->next;
+                                free( head );
+                                head = n;
+                        }
+                }
+        }
+
+        /// Size of the buffer handed out for a request of `size` bytes
+        static constexpr std::size_t capacity_for( std::size_t size )
+        {
+                if ( size > max_size )
+                        return size;
+                return std::max( std::bit_ceil( size ), std::size_t{ 1 } << min_shift );
+        }
+
+        /// Buffer of `capacity_for( size )` bytes, nullptr if the heap is exhausted
+        uint8_t* acquire( std::size_t size )
+        {
+                std::size_t const cap = capacity_for( size );
+                ++_stats.acquired;
+                if ( cap <= max_size && _free[class_of( cap )] ) {
+                        auto& head = _free[class_of( cap )];
+                        auto* n    = head;
+                        head       = n->next;
+                        _stats.cached_bytes -= cap;
+                        return (uint8_t*) n;
+                }
+                ++_stats.mallocs;
+                return (uint8_t*) malloc( cap );
+        }
+
+        /// Returns a buffer of `cap` bytes obtained from acquire()
+        void release( uint8_t* p, std::size_t cap )
+        {
+                if ( !p )
+                        return;
+                ++_stats.released;
+                if ( cap > max_size || _stats.cached_bytes + cap > max_cached ) {
+                        ++_stats.frees;
+                        free( p );
+                        return;
+                }
+                auto& head = _free[class_of( cap )];
+                head       = new ( p ) _node{ head };
+                _stats.cached_bytes += cap;
+        }
+
+        stats const& get_stats() const
+        {
+                return _stats;
+        }
+
+private:
+        struct _node
+        {
+                _node* next;
+        };
+
+        static std::size_t class_of( std::size_t cap )
+        {
+                return (std::size_t) std::countr_zero( cap ) - min_shift;
+        }
+
+        _node* _free[classes] = {};
+        stats  _stats;
+};
+
+}  // namespace trctl
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace trctl
+{
+
+/// Sorted set of at most N disjoint half-open ranges `[begin, end)`, touching and overlapping
+/// ranges are merged on insertion.
+template < std::size_t N >
+struct range_set
+{
+        struct range
+        {
+                uint64_t begin;
+                uint64_t end;
+
+                constexpr bool operator==( range const& ) const = default;
+        };
+
+        /// Adds `[begin, end)` to the set, returns false without modifying the set in case that
+        /// would require more than N ranges.
+        constexpr bool insert( uint64_t begin, uint64_t end )
+        {
+                if ( begin >= end )
+                        return true;
+                // first range that ends at or after `begin`, and first that starts after `end`
+                std::size_t i = 0;
+                while ( i < _n && _ranges[i].end < begin )
+                        ++i;
+                std::size_t j = i;
+                while ( j < _n && _ranges[j].begin <= end )
+                        ++j;
+
+                if ( i == j ) {
+                        if ( _n == N )
+                                return false;
+                        auto b = _ranges.begin();
+                        std::move_backward( b + i, b + _n, b + _n + 1 );
+                        _ranges[i] = { begin, end };
+                        ++_n;
+                        return true;
+                }
+                _ranges[i] = {
+                    std::min( begin, _ranges[i].begin ), std::max( end, _ranges[j - 1].end ) };
+                auto b = _ranges.begin();
+                std::move( b + j, b + _n, b + i + 1 );
+                _n -= j - i - 1;
+                return true;
+        }
+
+        /// Returns true if any byte of `[begin, end)` is already in the set
+        [[nodiscard]] constexpr bool overlaps( uint64_t begin, uint64_t end ) const
+        {
+                for ( std::size_t i = 0; i < _n; ++i )
+                        if ( _ranges[i].begin < end && begin < _ranges[i].end )
+                                return true;
+                return false;
+        }
+
+        /// End of the range starting at zero, every offset below it is in the set
+        [[nodiscard]] constexpr uint64_t contiguous() const
+        {
+                return _n != 0 && _ranges[0].begin == 0 ? _ranges[0].end : 0;
+        }
+
+        /// Returns true if the set is exactly `[0, size)`
+        [[nodiscard]] constexpr bool covers( uint64_t size ) const
+        {
+                return size == 0 ? _n == 0 : _n == 1 && _ranges[0] == range{ 0, size };
+        }
+
+        /// Calls `f( begin, end )` for every hole between zero and the end of the last range
+        constexpr void gaps( auto&& f ) const
+        {
+                uint64_t last = 0;
+                for ( std::size_t i = 0; i < _n; ++i ) {
+                        if ( _ranges[i].begin != last )
+                                f( last, _ranges[i].begin );
+                        last = _ranges[i].end;
+                }
+        }
+
+        [[nodiscard]] constexpr std::size_t size() const
+        {
+                return _n;
+        }
+
+        [[nodiscard]] constexpr range const& operator[]( std::size_t i ) const
+        {
+                return _ranges[i];
+        }
+
+private:
+        std::array< range, N > _ranges{};
+        std::size_t            _n = 0;
+};
+
+}  // namespace trctl
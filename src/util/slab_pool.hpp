@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+namespace trctl
+{
+
+/// Storage for objects of type T in slabs of `slab_slots` slots each. Released slots are kept in
+/// a free list and reused first, so both make() and destroy() are O(1). Slabs are returned to the
+/// heap only once the pool is destroyed, objects still alive at that point are destroyed too.
+template < typename T, std::size_t slab_slots = 64 >
+struct slab_pool
+{
+        struct stats
+        {
+                // slabs taken from the heap
+                uint64_t slabs = 0;
+                // objects alive right now and at most at once
+                uint64_t live = 0;
+                uint64_t peak = 0;
+        };
+
+        slab_pool() = default;
+
+        slab_pool( slab_pool const& )            = delete;
+        slab_pool& operator=( slab_pool const& ) = delete;
+
+        ~slab_pool()
+        {
+                while ( _slabs ) {
+                        auto* s = _slabs;
+                        _slabs  = s->next;
+                        for ( auto& slot : s->slots )
+                                if ( slot.used )
+                                        std::launder( (T*) slot.storage )->~T();
+                        delete s;
+                }
+        }
+
+        /// Constructs T from `args` in a free slot, nullptr if the heap is exhausted
+        template < typename... Args >
+        T* make( Args&&... args )
+        {
+                if ( !_free && !_grow() )
+                        return nullptr;
+                _slot* s = _free;
+                T*     p = new ( s->storage ) T( (Args&&) args... );
+                _free    = s->next_free;
+                s->used  = true;
+                if ( ++_stats.live > _stats.peak )
+                        _stats.peak = _stats.live;
+                return p;
+        }
+
+        /// Destroys object obtained from make() and returns its slot to the free list
+        void destroy( T* p )
+        {
+                auto* s = (_slot*) (void*) p;
+                p->~T();
+                s->used      = false;
+                s->next_free = std::exchange( _free, s );
+                --_stats.live;
+        }
+
+        /// Calls `f` with each live object, `f` may destroy the object it was called with
+        template < typename F >
+        void for_each( F&& f )
+        {
+                for ( auto* s = _slabs; s; s = s->next )
+                        for ( auto& slot : s->slots )
+                                if ( slot.used )
+                                        f( *std::launder( (T*) slot.storage ) );
+        }
+
+        std::size_t size() const
+        {
+                return _stats.live;
+        }
+
+        /// Bytes taken from the heap by all slabs
+        std::size_t reserved_bytes() const
+        {
+                return _stats.slabs * sizeof( _slab );
+        }
+
+        stats const& get_stats() const
+        {
+                return _stats;
+        }
+
+private:
+        // storage is the first member, so that a pointer to T is also a pointer to its slot
+        struct _slot
+        {
+                alignas( T ) std::byte storage[sizeof( T )];
+                _slot* next_free;
+                bool   used;
+        };
+
+        struct _slab
+        {
+                _slab* next;
+                _slot  slots[slab_slots];
+        };
+
+        bool _grow()
+        {
+                auto* s = new ( std::nothrow ) _slab;
+                if ( !s )
+                        return false;
+                s->next = std::exchange( _slabs, s );
+                // pushed in reverse, so that slots are handed out in address order
+                for ( std::size_t i = slab_slots; i-- > 0; ) {
+                        s->slots[i].used      = false;
+                        s->slots[i].next_free = std::exchange( _free, &s->slots[i] );
+                }
+                ++_stats.slabs;
+                return true;
+        }
+
+        _slab* _slabs = nullptr;
+        _slot* _free  = nullptr;
+        stats  _stats;
+};
+
+}  // namespace trctl
@@ -0,0 +1,118 @@
+#include "../async_sender_fifo.hpp"
+
+#include <functional>
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace trctl
+{
+
+// Operations that stay active until completed by the test
+struct gate
+{
+        int                                  started = 0;
+        std::vector< std::function< void() > > pending;
+
+        void complete_front()
+        {
+                auto f = std::move( pending.front() );
+                pending.erase( pending.begin() );
+                f();
+        }
+};
+
+struct gate_sender
+{
+        using sender_concept = ecor::sender_t;
+        gate* g;
+
+        template < typename Env >
+        using completion_signatures = ecor::completion_signatures< ecor::set_value_t() >;
+
+        template < typename Env >
+        completion_signatures< Env > get_completion_signatures( Env&& ) const noexcept
+        {
+                return {};
+        }
+
+        template < typename R >
+        struct _op
+        {
+                gate* g;
+                R     recv;
+
+                void start()
+                {
+                        ++g->started;
+                        g->pending.push_back( [this] {
+                                recv.set_value();
+                        } );
+                }
+        };
+
+        template < typename R >
+        _op< R > connect( R&& receiver ) && noexcept
+        {
+                return { g, std::move( receiver ) };
+        }
+};
+
+struct count_recv
+{
+        using receiver_concept = ecor::receiver_t;
+        int* done;
+
+        void set_value() noexcept
+        {
+                ++*done;
+        }
+};
+
+TEST( async_sender_fifo, serializes_by_default )
+{
+        gate              g;
+        int               done = 0;
+        async_sender_fifo fifo;
+
+        auto op1 = fifo.wrap( gate_sender{ &g } ).connect( count_recv{ &done } );
+        auto op2 = fifo.wrap( gate_sender{ &g } ).connect( count_recv{ &done } );
+        op1.start();
+        op2.start();
+        EXPECT_EQ( g.started, 1 );
+
+        g.complete_front();
+        EXPECT_EQ( done, 1 );
+        EXPECT_EQ( g.started, 2 );
+
+        g.complete_front();
+        EXPECT_EQ( done, 2 );
+}
+
+TEST( async_sender_fifo, limit )
+{
+        gate              g;
+        int               done = 0;
+        async_sender_fifo fifo{ 2 };
+
+        auto op1 = fifo.wrap( gate_sender{ &g } ).connect( count_recv{ &done } );
+        auto op2 = fifo.wrap( gate_sender{ &g } ).connect( count_recv{ &done } );
+        auto op3 = fifo.wrap( gate_sender{ &g } ).connect( count_recv{ &done } );
+        auto op4 = fifo.wrap( gate_sender{ &g } ).connect( count_recv{ &done } );
+        op1.start();
+        op2.start();
+        op3.start();
+        op4.start();
+        EXPECT_EQ( g.started, 2 );
+
+        // every completion starts exactly one waiting operation, in order
+        g.complete_front();
+        EXPECT_EQ( g.started, 3 );
+        g.complete_front();
+        EXPECT_EQ( g.started, 4 );
+        g.complete_front();
+        g.complete_front();
+        EXPECT_EQ( done, 4 );
+        EXPECT_EQ( g.started, 4 );
+}
+
+}  // namespace trctl
@@ -53,6 +53,23 @@ TEST( async, emplace_find_erase_lifetime )
         // When p goes out of scope, destructor will queue destruction.
 }
 
+TEST( async, shared_pointer_outlives_erase )
+{
+        test_ctx ctx{};
+        uint8_t  membuf[1024];
+
+        async_map< int, test_obj > m( ctx.loop, ctx, std::span< uint8_t >( membuf ) );
+        m.emplace( m.end(), 7, 77 );
+
+        auto it = m.find( 7 );
+        ASSERT_NE( it, m.end() );
+        async_ptr< test_obj > p = it->second.share();
+        m.erase( it );
+        EXPECT_EQ( m.size(), 0u );
+        ASSERT_TRUE( p );
+        EXPECT_EQ( p->value, 77 );
+}
+
 TEST( async, multiple_emplace_and_iteration )
 {
         test_ctx ctx;
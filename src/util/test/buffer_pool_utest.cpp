@@ -0,0 +1,53 @@
+#include "../buffer_pool.hpp"
+
+#include <gtest/gtest.h>
+
+namespace trctl
+{
+
+TEST( buffer_pool, capacity )
+{
+        EXPECT_EQ( buffer_pool::capacity_for( 0 ), 256u );
+        EXPECT_EQ( buffer_pool::capacity_for( 257 ), 512u );
+        EXPECT_EQ( buffer_pool::capacity_for( 65536 ), 65536u );
+        EXPECT_EQ( buffer_pool::capacity_for( 65537 ), 65537u );
+}
+
+TEST( buffer_pool, steady_state_without_mallocs )
+{
+        buffer_pool pool;
+
+        // a read into a large buffer, moved into a small one
+        for ( int i = 0; i < 100; ++i ) {
+                auto* big   = pool.acquire( 65536 );
+                auto* small = pool.acquire( 100 );
+                pool.release( big, 65536 );
+                pool.release( small, buffer_pool::capacity_for( 100 ) );
+        }
+        auto& st = pool.get_stats();
+        EXPECT_EQ( st.acquired, 200u );
+        EXPECT_EQ( st.released, 200u );
+        EXPECT_EQ( st.mallocs, 2u );
+        EXPECT_EQ( st.frees, 0u );
+        EXPECT_EQ( st.cached_bytes, 65536u + 256u );
+}
+
+TEST( buffer_pool, caps_cached_bytes )
+{
+        buffer_pool pool;
+        pool.max_cached = 1024;
+
+        auto* a = pool.acquire( 1024 );
+        auto* b = pool.acquire( 1024 );
+        pool.release( a, 1024 );
+        pool.release( b, 1024 );
+        EXPECT_EQ( pool.get_stats().frees, 1u );
+        EXPECT_EQ( pool.get_stats().cached_bytes, 1024u );
+
+        // oversized buffers never stay in the pool
+        auto* c = pool.acquire( 100000 );
+        pool.release( c, buffer_pool::capacity_for( 100000 ) );
+        EXPECT_EQ( pool.get_stats().frees, 2u );
+}
+
+}  // namespace trctl
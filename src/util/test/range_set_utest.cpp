@@ -0,0 +1,72 @@
+#include "../range_set.hpp"
+
+#include <gtest/gtest.h>
+#include <utility>
+#include <vector>
+
+namespace trctl
+{
+
+using range_list = std::vector< std::pair< uint64_t, uint64_t > >;
+
+template < std::size_t N >
+range_list ranges_of( range_set< N > const& s )
+{
+        range_list res;
+        for ( std::size_t i = 0; i < s.size(); ++i )
+                res.emplace_back( s[i].begin, s[i].end );
+        return res;
+}
+
+TEST( range_set, merge_in_order )
+{
+        range_set< 4 > s;
+        EXPECT_TRUE( s.insert( 0, 10 ) );
+        EXPECT_TRUE( s.insert( 10, 20 ) );
+        EXPECT_EQ( s.size(), 1u );
+        EXPECT_EQ( s.contiguous(), 20u );
+        EXPECT_TRUE( s.covers( 20 ) );
+        EXPECT_FALSE( s.covers( 21 ) );
+}
+
+TEST( range_set, out_of_order_and_gaps )
+{
+        range_set< 4 > s;
+        EXPECT_TRUE( s.insert( 20, 30 ) );
+        EXPECT_TRUE( s.insert( 40, 50 ) );
+        EXPECT_EQ( s.contiguous(), 0u );
+
+        range_list gaps;
+        s.gaps( [&]( uint64_t b, uint64_t e ) {
+                gaps.emplace_back( b, e );
+        } );
+        EXPECT_EQ( gaps, ( range_list{ { 0, 20 }, { 30, 40 } } ) );
+
+        // fills the hole between both ranges
+        EXPECT_TRUE( s.insert( 30, 40 ) );
+        EXPECT_EQ( ranges_of( s ), ( range_list{ { 20, 50 } } ) );
+        EXPECT_TRUE( s.insert( 0, 20 ) );
+        EXPECT_TRUE( s.covers( 50 ) );
+}
+
+TEST( range_set, overlap_and_capacity )
+{
+        range_set< 2 > s;
+        EXPECT_TRUE( s.insert( 0, 10 ) );
+        EXPECT_TRUE( s.insert( 20, 30 ) );
+        EXPECT_TRUE( s.overlaps( 5, 6 ) );
+        EXPECT_TRUE( s.overlaps( 25, 40 ) );
+        EXPECT_FALSE( s.overlaps( 10, 20 ) );
+
+        // third disjoint range does not fit
+        EXPECT_FALSE( s.insert( 40, 50 ) );
+        EXPECT_EQ( s.size(), 2u );
+
+        // overlapping insert spanning both ranges merges them
+        EXPECT_TRUE( s.insert( 5, 25 ) );
+        EXPECT_EQ( ranges_of( s ), ( range_list{ { 0, 30 } } ) );
+        EXPECT_TRUE( s.insert( 40, 50 ) );
+        EXPECT_EQ( s.size(), 2u );
+}
+
+}  // namespace trctl
@@ -0,0 +1,81 @@
+#include "../slab_pool.hpp"
+
+#include <gtest/gtest.h>
+#include <set>
+#include <vector>
+
+namespace trctl
+{
+
+struct counted
+{
+        static inline int alive = 0;
+
+        int value;
+
+        counted( int v )
+          : value( v )
+        {
+                ++alive;
+        }
+
+        ~counted()
+        {
+                --alive;
+        }
+};
+
+TEST( slab_pool, reuses_released_slots )
+{
+        slab_pool< counted, 4 > pool;
+
+        std::vector< counted* > xs;
+        for ( int i = 0; i < 10; ++i )
+                xs.push_back( pool.make( i ) );
+        EXPECT_EQ( pool.size(), 10u );
+        EXPECT_EQ( pool.get_stats().slabs, 3u );
+        EXPECT_EQ( counted::alive, 10 );
+
+        pool.destroy( xs[3] );
+        pool.destroy( xs[7] );
+        EXPECT_EQ( counted::alive, 8 );
+
+        // last released slot is handed out first, no new slab is needed
+        auto* a = pool.make( 42 );
+        auto* b = pool.make( 43 );
+        EXPECT_EQ( a, xs[7] );
+        EXPECT_EQ( b, xs[3] );
+        EXPECT_EQ( pool.get_stats().slabs, 3u );
+        EXPECT_EQ( pool.get_stats().peak, 10u );
+}
+
+TEST( slab_pool, iterates_live_objects )
+{
+        slab_pool< counted, 4 > pool;
+
+        std::vector< counted* > xs;
+        for ( int i = 0; i < 6; ++i )
+                xs.push_back( pool.make( i ) );
+        pool.destroy( xs[1] );
+
+        std::set< int > seen;
+        pool.for_each( [&]( counted& c ) {
+                seen.insert( c.value );
+                if ( c.value == 4 )
+                        pool.destroy( &c );
+        } );
+        EXPECT_EQ( seen, ( std::set< int >{ 0, 2, 3, 4, 5 } ) );
+        EXPECT_EQ( pool.size(), 4u );
+}
+
+TEST( slab_pool, destroys_leftovers )
+{
+        {
+                slab_pool< counted > pool;
+                for ( int i = 0; i < 100; ++i )
+                        pool.make( i );
+        }
+        EXPECT_EQ( counted::alive, 0 );
+}
+
+}  // namespace trctl